@@ -0,0 +1,172 @@
+/**
+* @file wheel_bench.c
+* @author sharan-naribole
+* @brief Host benchmark: timing wheel vs. the linear unblock_tasks() scan.
+*
+* Builds the kernel's own src/timer_wheel.c against the real TCB and runs
+* both wakeup schemes over the same sleepers: each sleeps a pseudo-random
+* 1..SLEEP_MAX ticks, wakes, and goes straight back to sleep. Per tick the
+* scan compares every task's wakeup tick (what unblock_tasks() did before
+* the wheel); the wheel serves one slot and cascades on wrap. Both must
+* wake the same tasks on the same ticks, or the run fails.
+*
+* Absolute figures are host nanoseconds, not Cortex-M4 cycles (use
+* USE_KERNEL_STATS on target for those); the growth with the sleeper count
+* is what carries over.
+*/
+
+#include "timer_wheel.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Simulated ticks per run, and the longest sleep (ticks)
+#define BENCH_TICKS 20000U
+#define SLEEP_MAX 1000U
+
+/* The kernel's tick counter; timer_wheel_insert() measures delays from it */
+uint32_t g_tick_count = 0;
+
+
+static uint32_t bench_rand(uint32_t* state)
+{
+	*state = (*state * 1103515245U) + 12345U;
+	return *state >> 8;
+}
+
+static uint64_t bench_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+}
+
+// Old scheme: no queue at all, every tick checks every task
+static uint64_t bench_scan(TCB_t* tasks, const uint32_t* periods, uint32_t n, uint64_t* checksum)
+{
+	uint64_t start;
+	uint64_t sum = 0;
+
+	g_tick_count = 0;
+	for(uint32_t i = 0; i < n; i++)
+	{
+		tasks[i].flags = TASK_FLAG_USED | TASK_FLAG_BLOCKED;
+		tasks[i].block_count = periods[i];
+	}
+
+	start = bench_ns();
+	for(uint32_t t = 0; t < BENCH_TICKS; t++)
+	{
+		uint32_t now = ++g_tick_count;
+
+		for(uint32_t i = 0; i < n; i++)
+		{
+			if((tasks[i].flags & TASK_FLAG_BLOCKED) && (tasks[i].block_count == now))
+			{
+				sum += (uint64_t)i * now;
+				tasks[i].block_count = now + periods[i]; // Straight back to sleep
+			}
+		}
+	}
+
+	*checksum = sum;
+	return bench_ns() - start;
+}
+
+// New scheme: the kernel's timing wheel
+static uint64_t bench_wheel(TCB_t* tasks, const uint32_t* periods, uint32_t n, uint64_t* checksum,
+		uint64_t* insert_ns, uint64_t* wakeups)
+{
+	uint64_t start;
+	uint64_t sum = 0;
+	uint64_t woken = 0;
+
+	g_tick_count = 0;
+	start = bench_ns();
+	for(uint32_t i = 0; i < n; i++)
+	{
+		tasks[i].flags = TASK_FLAG_USED | TASK_FLAG_BLOCKED;
+		tasks[i].block_count = periods[i];
+		timer_wheel_insert(&tasks[i]);
+	}
+	*insert_ns = bench_ns() - start;
+
+	start = bench_ns();
+	for(uint32_t t = 0; t < BENCH_TICKS; t++)
+	{
+		uint32_t now = ++g_tick_count;
+		TCB_t* tcb = timer_wheel_expire(now);
+
+		while(tcb != NULL)
+		{
+			TCB_t* next = tcb->next;
+			uint32_t i = (uint32_t)(tcb - tasks);
+
+			sum += (uint64_t)i * now;
+			woken++;
+			tcb->block_count = now + periods[i];
+			timer_wheel_insert(tcb);
+			tcb = next;
+		}
+	}
+	uint64_t elapsed = bench_ns() - start;
+
+	// Leave the wheel empty for the next run
+	for(uint32_t i = 0; i < n; i++)
+		timer_wheel_remove(&tasks[i]);
+
+	*checksum = sum;
+	*wakeups = woken;
+	return elapsed;
+}
+
+int main(void)
+{
+	static const uint32_t sleepers[] = { 10U, 100U, 10000U };
+	int failed = 0;
+
+	printf("%u ticks, sleeps of 1..%u ticks (ns on this host)\n", BENCH_TICKS, SLEEP_MAX);
+	printf("%9s %13s %14s %14s %16s\n", "sleepers", "wakeups/tick", "scan ns/tick", "wheel ns/tick",
+			"wheel ns/insert");
+
+	for(uint32_t k = 0; k < sizeof(sleepers) / sizeof(sleepers[0]); k++)
+	{
+		uint32_t n = sleepers[k];
+		TCB_t* tasks = calloc(n, sizeof(TCB_t));
+		uint32_t* periods = calloc(n, sizeof(uint32_t));
+		uint32_t seed = 1U;
+		uint64_t scan_sum;
+		uint64_t wheel_sum;
+		uint64_t insert_ns;
+		uint64_t wakeups;
+
+		if((tasks == NULL) || (periods == NULL))
+		{
+			printf("out of memory\n");
+			return 1;
+		}
+
+		for(uint32_t i = 0; i < n; i++)
+			periods[i] = 1U + (bench_rand(&seed) % SLEEP_MAX);
+
+		uint64_t scan_ns = bench_scan(tasks, periods, n, &scan_sum);
+		uint64_t wheel_ns = bench_wheel(tasks, periods, n, &wheel_sum, &insert_ns, &wakeups);
+
+		printf("%9u %13.1f %14.1f %14.1f %16.1f\n", n, (double)wakeups / BENCH_TICKS,
+				(double)scan_ns / BENCH_TICKS, (double)wheel_ns / BENCH_TICKS, (double)insert_ns / n);
+
+		if(scan_sum != wheel_sum)
+		{
+			printf("  mismatch: the wheel woke different tasks than the scan\n");
+			failed = 1;
+		}
+
+		free(periods);
+		free(tasks);
+	}
+
+	return failed;
+}
@@ -0,0 +1,102 @@
+/**
+* @file kstats.c
+* @author sharan-naribole
+* @brief Optional cycle-accurate kernel instrumentation (DWT CYCCNT).
+*/
+
+#include "kstats.h"
+
+#if USE_KERNEL_STATS
+
+#include <stdio.h>
+
+
+// --- Debug / DWT registers (ARMv7-M ARM, C1.6 and C1.8) -----------------------
+#define DEMCR REG32(0xE000EDFCUL)
+#define DWT_CTRL REG32(0xE0001000UL)
+#define DWT_CYCCNT REG32(0xE0001004UL)
+
+#define DEMCR_TRCENA_Msk (1UL << 24)
+#define DWT_CTRL_CYCCNTENA_Msk (1UL << 0)
+
+
+/* Debugger-visible: add g_kstats to a live watch window */
+kstats_t g_kstats;
+
+extern uint32_t g_pendsv_avoided;
+extern uint32_t g_pendsv_same_task;
+
+
+static void kstats_reset_path(kstats_path_t* path)
+{
+	*path = (kstats_path_t){ .min = UINT32_MAX };
+}
+
+void kstats_init(void)
+{
+	// DWT is part of the trace block: TRCENA powers it up
+	DEMCR |= DEMCR_TRCENA_Msk;
+	DWT_CYCCNT = 0;
+	DWT_CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	kstats_reset_path(&g_kstats.systick);
+	kstats_reset_path(&g_kstats.quiet);
+	kstats_reset_path(&g_kstats.unblock);
+	kstats_reset_path(&g_kstats.pick);
+	kstats_reset_path(&g_kstats.pendsv);
+	kstats_reset_path(&g_kstats.wakeup);
+	kstats_reset_path(&g_kstats.svc);
+}
+
+KERNEL_RAMFUNC void kstats_record(kstats_path_t* path, uint32_t cycles)
+{
+	// Called from handlers at the same priority only, so no locking needed
+	uint32_t bin = (cycles == 0) ? 0 : (32U - (uint32_t)__builtin_clz(cycles));
+	if(bin >= KSTATS_HIST_BINS)
+		bin = KSTATS_HIST_BINS - 1U;
+
+	path->count++;
+	path->total += cycles;
+	if(cycles < path->min)
+		path->min = cycles;
+	if(cycles > path->max)
+		path->max = cycles;
+	path->hist[bin]++;
+}
+
+static void kstats_dump_path(const char* name, const kstats_path_t* path)
+{
+	if(path->count == 0)
+	{
+		printf("%-8s no samples\n", name);
+		return;
+	}
+
+	// Jitter = max - min: compare builds with and without USE_RAM_SCHEDULER
+	printf("%-8s n=%lu min=%lu avg=%lu max=%lu jitter=%lu cycles\n", name,
+			(unsigned long)path->count, (unsigned long)path->min,
+			(unsigned long)(path->total / path->count), (unsigned long)path->max,
+			(unsigned long)(path->max - path->min));
+
+	printf("         hist:");
+	for(uint32_t b = 0; b < KSTATS_HIST_BINS; b++)
+		printf(" %lu", (unsigned long)path->hist[b]);
+	printf("\n");
+}
+
+void kstats_dump(void)
+{
+	printf("--- kernel stats (cycles @ %lu Hz) ---\n", (unsigned long)SYSTICK_TIM_CLK);
+	kstats_dump_path("systick", &g_kstats.systick);
+	kstats_dump_path("quiet", &g_kstats.quiet);
+	kstats_dump_path("unblock", &g_kstats.unblock);
+	kstats_dump_path("pick", &g_kstats.pick);
+	kstats_dump_path("pendsv", &g_kstats.pendsv);
+	kstats_dump_path("wakeup", &g_kstats.wakeup);
+	kstats_dump_path("svc", &g_kstats.svc);
+	printf("pendsv avoided=%lu same-task=%lu\n",
+			(unsigned long)g_pendsv_avoided, (unsigned long)g_pendsv_same_task);
+	kstats_dump_tasks();
+}
+
+#endif // USE_KERNEL_STATS
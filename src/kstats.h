@@ -0,0 +1,101 @@
+/**
+* @file kstats.h
+* @author sharan-naribole
+* @brief Optional cycle-accurate kernel instrumentation (DWT CYCCNT).
+*
+* Times the scheduler's hot paths (SysTick_Handler, unblock_tasks(),
+* next-task selection, PendSV_Handler, SVC system calls) and the tick-to-run latency of every woken task, keeping
+* min/avg/max and a log2 histogram per path. Everything lives in g_kstats,
+* so a debugger can read it live; kstats_dump() prints it through printf
+* (ITM/semihosting/UART, whichever _write() is retargeted to).
+*
+* Enabled with USE_KERNEL_STATS in main.h; when disabled the KSTATS_*
+* macros compile to nothing.
+*/
+
+#ifndef KSTATS_H_
+#define KSTATS_H_
+
+#include "main.h"
+
+#include <stdint.h>
+
+
+// -----------------------------------------------------------------------------
+// Per-path statistics
+// -----------------------------------------------------------------------------
+// Bin b counts samples of 2^(b-1) .. 2^b - 1 cycles; the last bin is open ended
+#define KSTATS_HIST_BINS 16U
+
+typedef struct
+{
+	uint32_t count;
+	uint32_t min; // Cycles
+	uint32_t max;
+	uint64_t total; // avg = total / count
+	uint32_t hist[KSTATS_HIST_BINS];
+} kstats_path_t;
+
+typedef struct
+{
+	kstats_path_t systick; // Whole SysTick_Handler
+	kstats_path_t quiet; // SysTick_Handler on ticks that woke no task
+	kstats_path_t unblock; // unblock_tasks() (timing wheel expiry) per tick
+	kstats_path_t pick; // pick_next_task() in schedule(): the selection half of a switch
+	kstats_path_t pendsv; // PendSV_Handler, including the same-task fast exit
+	kstats_path_t wakeup; // SysTick entry → woken task running (cycles)
+	kstats_path_t svc; // System call dispatch in SVC_Handler
+} kstats_t;
+
+extern kstats_t g_kstats;
+
+
+// -----------------------------------------------------------------------------
+// Public API
+// -----------------------------------------------------------------------------
+/**
+* @brief Enable the DWT cycle counter and reset all statistics.
+*/
+void kstats_init(void);
+
+/**
+* @brief Add one sample (in cycles) to a path.
+*/
+void kstats_record(kstats_path_t* path, uint32_t cycles);
+
+/**
+* @brief Print every path, the scheduler counters and per-task figures.
+*/
+void kstats_dump(void);
+
+/**
+* @brief Per-task part of kstats_dump(); lives with the TCBs in main.c.
+*/
+void kstats_dump_tasks(void);
+
+/**
+* @brief Current DWT cycle count (wraps every 2^32 cycles, ~4.5 min @ 16 MHz).
+*/
+static inline uint32_t kstats_now(void)
+{
+	return *(volatile uint32_t*)0xE0001004UL; // DWT_CYCCNT
+}
+
+#if USE_KERNEL_STATS
+#define KSTATS_BEGIN(stamp)  uint32_t stamp = kstats_now()
+#define KSTATS_END(path, stamp)  kstats_record(&g_kstats.path, kstats_now() - (stamp))
+// One reading recorded into path and, when cond holds, also into subset
+#define KSTATS_END_ALSO_IF(path, cond, subset, stamp)  do { \
+		uint32_t kstats_cycles = kstats_now() - (stamp); \
+		kstats_record(&g_kstats.path, kstats_cycles); \
+		if(cond) \
+			kstats_record(&g_kstats.subset, kstats_cycles); \
+	} while(0)
+#else
+#define KSTATS_BEGIN(stamp)
+#define KSTATS_END(path, stamp)
+#define KSTATS_END_ALSO_IF(path, cond, subset, stamp)  ((void)(cond))
+#endif
+
+
+#endif // KSTATS_H_
@@ -6,9 +6,7 @@
 
 
 #include "led.h"
-
-// Keep register access explicit and readable.
-#define REG32(addr) (*(volatile uint32_t *)(addr))
+#include "main.h"
 
 
 // --- RCC / GPIO base addresses (RM0090) --------------------------------------
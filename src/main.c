@@ -1,86 +1,312 @@
 /**
 * @file main.c
 * @author sharan-naribole
-* @brief Tiny RTOS‑style cooperative scheduler on Cortex‑M4 using SysTick
-* (time base) and PendSV (context switch). Blinks four LEDs at
+* @brief Small fixed-priority preemptive scheduler on Cortex‑M4 using SysTick
+* (time base) and PendSV (context switch), with round-robin time slicing. Blinks four LEDs at
 * different rates by scheduling 4 tasks + an idle task.
 *
 * Key ideas:
 * - Each task has a private stack and a small TCB with state and PSP value.
-* - Tasks transition READY ⇄ BLOCKED via task_delay() and SysTick unblocking.
-* - SysTick sets PendSV pending after housekeeping; task_delay() also pends
-* PendSV for immediate yield.
-* - PendSV saves R4..R11 to the current task stack, switches PSP, and restores
-* the next task.
+* - Tasks transition READY ⇄ BLOCKED via task_delay()/task_delay_until() and
+* SysTick unblocking.
+* - READY tasks sit in a FIFO per priority level; the highest non-empty level
+* runs, so a woken short-period task preempts longer ones on the next switch.
+* - SysTick pends PendSV only when a task that outranks the running one woke
+* or the running task's round-robin quantum expired; task_delay() also
+* pends PendSV for immediate yield.
+* - main() creates the tasks, then an SVC exception-returns into the first
+* one with MSP reset; it never runs on main()'s frame.
+* - schedule() picks the next task up front; PendSV saves R4..R11 to the
+* current task stack, swaps g_current_tcb for g_next_tcb, and restores the
+* next task.
 */
 
 #include "main.h"
 #include "led.h"
-
+#include "kstats.h"
+#include "pt.h"
+#include "sst.h"
+#include "mempool.h"
+#include "sweep.h"
+#include "tcb.h"
+#include "timer_wheel.h"
+
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
-
-// -----------------------------------------------------------------------------
-// Task Control Block (TCB)
-/* This is a task control block carries private information of each task */
+#include <string.h>
+
+// Largest stack a task can have: stack_size is 16 bits
+#define TASK_STACK_MAX (0x10000U - STACK_BLOCK_SIZE)
+
+// Kernel RAM: in CCM (NOLOAD, so TCBs are zeroed by hand in main()) or in
+// plain .bss. Stacks are block aligned for the allocator and MPU guard.
+#if USE_CCM_STACKS
+#define KERNEL_RAM __attribute__((section(".ccm_noinit")))
+_Static_assert((STACK_POOL_SIZE + SIZE_SCHED_STACK) <= CCMRAM_SIZE, "stacks do not fit in CCM RAM");
+#else
+#define KERNEL_RAM
+_Static_assert((STACK_POOL_SIZE + SIZE_SCHED_STACK) <= SRAM_SIZE, "stacks do not fit in SRAM");
+#endif
+_Static_assert((STACK_POOL_SPARE % STACK_BLOCK_SIZE) == 0, "stack pool must be whole blocks");
+#define KERNEL_STACK KERNEL_RAM __attribute__((aligned(STACK_BLOCK_SIZE)))
+
+uint8_t stack_pool[STACK_POOL_SIZE] KERNEL_STACK;
+uint8_t sched_stack[SIZE_SCHED_STACK] KERNEL_STACK;
+#define STACK_POOL_START ((uint32_t)stack_pool)
+#define SCHED_STACK_START ((uint32_t)&sched_stack[SIZE_SCHED_STACK])
+
+/* Message blocks: deterministic alloc/free from tasks and ISRs */
+MEMPOOL_DEFINE(g_msg_pool, MSG_POOL_BLOCK_SIZE, MSG_POOL_BLOCKS);
+
+/* Each task has its own TCB; slots are claimed by task_create() */
+TCB_t user_tasks[MAX_TASKS] KERNEL_RAM;
+
+/* One FIFO of READY tasks per priority level */
 typedef struct
 {
-	uint32_t psp_value; // Process stack pointer snapshot
-	uint32_t block_count; // Wakeup tick
-	uint8_t current_state; // READY or BLOCKED
-	void (*task_handler)(void); // Entry function
-} TCB_t;
-
-/* Each task has its own TCB */
-TCB_t user_tasks[MAX_TASKS];
-
-uint32_t PSP_INIT_ADDRS[MAX_TASKS] = {
-		IDLE_STACK_START,
-		T1_STACK_START,
-		T2_STACK_START,
-		T3_STACK_START,
-		T4_STACK_START
-};
+	TCB_t* head; // Next to run at this level (the running task stays at the head)
+	TCB_t* tail;
+} ready_list_t;
+
+ready_list_t ready_lists[MAX_PRIORITIES];
+
+/* Bit p is set while ready_lists[p] is non-empty: CLZ finds the top level */
+_Static_assert(MAX_PRIORITIES <= 32, "ready bitmap holds at most 32 priority levels");
+uint32_t g_ready_mask = 0;
+
+/* READY periodic tasks in EDF mode, earliest absolute deadline first */
+TCB_t* edf_ready_list = NULL;
+
+/* Only periodic tasks are deadline-scheduled; the rest keep fixed priority */
+#if (SCHED_POLICY == SCHED_POLICY_EDF)
+#define TCB_USES_EDF(tcb) ((tcb)->period != 0)
+#else
+#define TCB_USES_EDF(tcb) 0
+#endif
+
+/* Task stack pool: bit b set while block b (STACK_BLOCK_SIZE bytes, counted
+ * up from STACK_POOL_START) belongs to a task */
+uint32_t stack_pool_map[(STACK_POOL_BLOCKS + 31U) / 32U];
+
+/* Task whose TCB and stack are released after the next context switch */
+int g_zombie_task = -1;
+
+/* Set once main() hands the CPU to the first task */
+uint8_t g_scheduler_started = 0;
 
 // Forward declarations ---------------------------------------------------------
-void task1_handler(void);
-void task2_handler(void);
-void task3_handler(void);
-void task4_handler(void);
-void idle_handler(void);
+void task1_handler(void* arg);
+void task2_handler(void* arg);
+void task3_handler(void* arg);
+void task4_handler(void* arg);
+int led_blink_pt(pt_t* pt);
+void led_blink_sst(sst_task_t* me, const sst_evt_t* e);
+void idle_handler(void* arg);
+void task_exit(void);
 
 void init_systick_timer(uint32_t tick_hz);
 __attribute__((naked)) void init_scheduler_stack(uint32_t sched_top_of_stack);
-void init_tasks_stack(void);
+void init_task_frame(TCB_t* tcb, void (*entry)(void*), void* arg);
+uint32_t stack_pool_alloc(uint32_t size);
+void stack_pool_free(uint32_t base, uint32_t size);
 void enable_processor_faults(void);
-__attribute__((naked)) void switch_sp_to_psp(void);
-uint32_t get_psp_value(void);
-void save_psp_value(uint32_t current_psp);
-void update_current_task(void);
+void enable_fpu(void);
+void mpu_init(void);
+void stack_paint(TCB_t* tcb);
+uint32_t stack_unused_bytes(uint32_t base, uint32_t limit);
+void stack_unused_lower(TCB_t* tcb, uint16_t generation, uint32_t unused);
+void stack_scan_step(void);
+void start_scheduler(void);
+void reclaim_zombie_task(void);
+void ready_list_append(TCB_t* tcb);
+void ready_list_remove(TCB_t* tcb);
+TCB_t* pick_next_task(void);
+void edf_list_insert(TCB_t* tcb);
+void edf_list_remove(TCB_t* tcb);
+void tickless_enter(void);
+void tickless_exit(void);
+void tickless_catch_up(uint32_t ticks);
+void systick_restart(uint32_t first_reload);
+
+// System calls: public task API → SVC → sys_* body in handler mode
+int syscall_direct(void);
+void svc_dispatch(uint32_t* frame);
+int sys_task_create(void (*entry)(void*), void* arg, uint32_t stack_size, uint8_t priority);
+void sys_task_delete(int task_id);
+void sys_task_delay(uint32_t tick_count);
+uint32_t sys_task_delay_until(uint32_t last_wake, uint32_t period);
+void sys_task_yield(void);
+
+// SVC #num with up to four word arguments in R0-R3; result from R0
+#define SYSCALL(num, a0, a1, a2, a3) ({ \
+	register uint32_t r0 __asm("r0") = (uint32_t)(a0); \
+	register uint32_t r1 __asm("r1") = (uint32_t)(a1); \
+	register uint32_t r2 __asm("r2") = (uint32_t)(a2); \
+	register uint32_t r3 __asm("r3") = (uint32_t)(a3); \
+	__asm volatile("SVC %[n]" : "+r"(r0) : [n] "I"(num), "r"(r1), "r"(r2), "r"(r3) : "memory"); \
+	r0; })
 
 // Task blocking state machine
 /* This variable gets updated from SysTick handler for every SysTick interrupt */
 uint32_t g_tick_count = 0;
-void task_delay(uint32_t tick_count);
+void block_current_task(uint32_t wake_tick);
 void update_global_tick_count(void);
-void unblock_tasks(void);
+uint32_t unblock_tasks(void);
 void schedule(void);
 
-// Current running task index: start with Task1 (user task)
-uint8_t current_task = 1;
+// Tasks main() creates, in order, each with its own stack size (BOOT_TASKS
+// in main.h)
+typedef struct
+{
+	void (*entry)(void*);
+	uint32_t stack_size;
+	uint8_t priority;
+} task_config_t;
+
+#define BOOT_TASK_CONFIG(entry, stack_size, priority) { entry, stack_size, priority },
+
+const task_config_t boot_tasks[] =
+{
+	BOOT_TASKS(BOOT_TASK_CONFIG)
+};
+_Static_assert(BOOT_TASK_COUNT <= MAX_TASKS, "more boot tasks than TCBs");
+
+#if USE_PROTOTHREAD_LEDS || USE_SST_KERNEL
+// Stackless blinkers: one table entry each
+typedef struct
+{
+	uint8_t led;
+	uint32_t period;
+	uint8_t priority;
+} led_blink_t;
+
+const led_blink_t led_blinks[] =
+{
+	{ LED_GREEN, LED_GREEN_FREQ, T1_PRIORITY },
+	{ LED_ORANGE, LED_ORANGE_FREQ, T2_PRIORITY },
+	{ LED_BLUE, LED_BLUE_FREQ, T3_PRIORITY },
+	{ LED_RED, LED_RED_FREQ, T4_PRIORITY },
+};
+#define LED_BLINK_COUNT (sizeof(led_blinks) / sizeof(led_blinks[0]))
+#endif
+
+#if USE_SST_KERNEL
+// Run-to-completion blinker: the kernel task plus its time event and queue
+#define LED_SIG_TIMEOUT SST_SIG_USER
+
+typedef struct
+{
+	sst_task_t super;
+	sst_time_evt_t timeout;
+	const sst_evt_t* queue[2];
+	const led_blink_t* blink;
+	uint8_t on;
+} led_task_t;
+
+led_task_t led_tasks[LED_BLINK_COUNT];
+#elif USE_PROTOTHREAD_LEDS
+pt_t led_pts[LED_BLINK_COUNT];
+#endif
+
+/* Ticks the current tickless sleep was programmed for (0: normal ticking) */
+uint32_t g_tickless_ticks = 0;
+
+/* Ticks left in the running task's round-robin quantum */
+uint32_t g_slice_left = TIME_SLICE_TICKS;
+
+/* Ticks on which SysTick skipped PendSV because nothing more urgent woke */
+uint32_t g_pendsv_avoided = 0;
+
+/* PendSVs that found g_next_tcb == g_current_tcb and skipped the save/restore */
+uint32_t g_pendsv_same_task = 0;
+
+// Running task, and the task PendSV switches to (chosen by schedule()).
+// PendSV reads both directly: psp_value must stay the first TCB field.
+TCB_t* volatile g_current_tcb = NULL;
+TCB_t* volatile g_next_tcb = NULL;
+_Static_assert(offsetof(TCB_t, psp_value) == 0, "PendSV_Handler loads psp_value at offset 0");
+#if USE_STACK_WATERMARK
+// Painting starts above the MPU guard: those bytes can't be used (or read
+// by the owner) anyway
+#if USE_MPU_STACK_GUARD
+#define STACK_PAINT_OFFSET MPU_GUARD_SIZE
+#else
+#define STACK_PAINT_OFFSET 0U
+#endif
+
+/* Next task the idle-time watermark scanner looks at */
+uint32_t g_stack_scan_task = 0;
+#endif
+
+#if USE_MPU_STACK_GUARD
+_Static_assert(offsetof(TCB_t, mpu_guard_rbar) == 4, "PendSV_Handler loads mpu_guard_rbar at offset 4");
+_Static_assert((STACK_BLOCK_SIZE % MPU_GUARD_SIZE) == 0,
+		"every stack base must be aligned for the MPU guard region");
+#endif
+
+#if USE_KERNEL_STATS
+/* CYCCNT at entry of the current SysTick: start of every wakeup latency */
+uint32_t g_tick_stamp = 0;
+void pendsv_stats_enter(void);
+void pendsv_stats_exit(void);
+#endif
+
+#if PENDSV_BASELINE_CALLS
+/* Index of g_current_tcb in user_tasks[], as the old switch path kept it */
+uint32_t g_current_task = 0;
+void save_psp_value(uint32_t current_psp);
+void update_current_task(void);
+uint32_t get_psp_value(void);
+#endif
 
 
 int main(void)
 {
 	enable_processor_faults();
+	enable_fpu();
 	init_scheduler_stack(SCHED_STACK_START);
-	init_tasks_stack();
 	led_init_all();
+#if USE_CCM_STACKS
+	memset(user_tasks, 0, sizeof(user_tasks)); // .ccm_noinit is not zeroed at startup
+#endif
+	mempool_init(&g_msg_pool);
+#if USE_KERNEL_STATS
+	kstats_init();
+#endif
+
+#if USE_SST_KERNEL
+	// Run-to-completion model: each blinker is an event handler on the one
+	// MSP stack; nothing below (task_create, start_scheduler) is used
+	INTERRUPT_DISABLE();
+	for(uint32_t i = 0; i < LED_BLINK_COUNT; i++)
+	{
+		led_tasks[i].blink = &led_blinks[i];
+		sst_task_start(&led_tasks[i].super, led_blinks[i].priority,
+				led_tasks[i].queue, 2, led_blink_sst);
+	}
 	init_systick_timer(TICK_HZ);
-	switch_sp_to_psp();
+	sst_run();
+#endif
 
-	// Start the first task explicitly (returns via context switches afterward)
-	task1_handler();
+#if USE_PROTOTHREAD_LEDS
+	for(uint32_t i = 0; i < LED_BLINK_COUNT; i++)
+		pt_spawn(&led_pts[i], led_blink_pt, (void*)&led_blinks[i]);
+#endif
+
+	for(uint32_t i = 0; i < BOOT_TASK_COUNT; i++)
+	{
+		// Every boot task must exist before the launch: without idle the
+		// ready mask can be empty, and picking from it is undefined
+		if(task_create(boot_tasks[i].entry, NULL, boot_tasks[i].stack_size, boot_tasks[i].priority) < 0)
+		{
+			printf("Boot task %lu: no TCB or stack space\n", (unsigned long)i);
+			while(1);
+		}
+	}
+
+	// Hand the CPU to the first task; main() is never returned to
+	start_scheduler();
 
 	/* Loop forever */
 	for(;;);
@@ -96,6 +322,63 @@ void enable_processor_faults(void)
 	*pSHCSR |= (1 << USAGE_FAULT_EN_BIT);
 }
 
+void enable_fpu(void)
+{
+#if USE_FPU_CONTEXT
+	uint32_t volatile* pCPACR = (uint32_t*)CPACR_REG;
+	uint32_t volatile* pFPCCR = (uint32_t*)FPCCR_REG;
+
+	// Full access to CP10/CP11 (the FPU)
+	*pCPACR |= (0xF << 20);
+	// Automatic FP state preservation on exception entry, deferred (lazy) until
+	// the handler actually uses the FPU
+	*pFPCCR |= (1UL << FPCCR_ASPEN_BIT) | (1UL << FPCCR_LSPEN_BIT);
+	__asm volatile("DSB");
+	__asm volatile("ISB");
+#endif
+}
+
+#if USE_MPU_STACK_GUARD
+// RASR: XN, AP, TEX/S/C/B, region size 2^size_log2, enable
+#define MPU_RASR(size_log2, ap, tex_scb, xn) \
+	(((uint32_t)(xn) << 28) | ((uint32_t)(ap) << 24) | ((uint32_t)(tex_scb) << 16) | \
+	(((uint32_t)(size_log2) - 1U) << 1) | 1U)
+#define MPU_AP_NONE 0U
+#define MPU_AP_FULL 3U
+#define MPU_AP_RO 6U
+#define MPU_NORMAL_WT 0x02U // TEX=0 C=1 B=0
+#define MPU_NORMAL_WB 0x03U // TEX=0 C=1 B=1
+#define MPU_DEVICE 0x05U // TEX=0 S=1 B=1
+
+void mpu_init(void)
+{
+	uint32_t volatile* pRBAR = (uint32_t*)MPU_RBAR_REG;
+	uint32_t volatile* pRASR = (uint32_t*)MPU_RASR_REG;
+	uint32_t volatile* pCTRL = (uint32_t*)MPU_CTRL_REG;
+	uint32_t valid = (1U << MPU_RBAR_VALID_BIT);
+
+	// Unprivileged tasks only see what a region grants (privileged code keeps
+	// the default map): flash read/execute, SRAM and peripherals read/write
+	*pRBAR = 0x08000000U | valid | 0U;
+	*pRASR = MPU_RASR(20, MPU_AP_RO, MPU_NORMAL_WT, 0); // 1 MB flash
+	*pRBAR = SRAM_START | valid | 1U;
+	*pRASR = MPU_RASR(17, MPU_AP_FULL, MPU_NORMAL_WB, 0); // 128 KB SRAM1+SRAM2
+	*pRBAR = 0x40000000U | valid | 2U;
+	*pRASR = MPU_RASR(29, MPU_AP_FULL, MPU_DEVICE, 1); // 512 MB peripherals
+#if USE_CCM_STACKS
+	*pRBAR = CCMRAM_START | valid | 3U;
+	*pRASR = MPU_RASR(16, MPU_AP_FULL, MPU_NORMAL_WB, 1); // 64 KB CCM: task stacks
+#endif
+
+	// Guard: no access for anyone, over the first task's stack bottom
+	*pRBAR = g_current_tcb->mpu_guard_rbar;
+	*pRASR = MPU_RASR(5, MPU_AP_NONE, MPU_NORMAL_WB, 1);
+
+	*pCTRL = (1U << MPU_CTRL_PRIVDEFENA_BIT) | (1U << MPU_CTRL_ENABLE_BIT);
+	__asm volatile("DSB\n\tISB" : : : "memory");
+}
+#endif
+
 void init_systick_timer(uint32_t tick_hz)
 {
 	uint32_t count_val = (SYSTICK_TIM_CLK/tick_hz) - 1;
@@ -121,235 +404,1103 @@ __attribute__((naked)) void init_scheduler_stack(uint32_t top_sched_stack)
 	__asm volatile("BX LR"); // Return from Function call
 }
 
-void init_tasks_stack(void)
+int sys_task_create(void (*entry)(void*), void* arg, uint32_t stack_size, uint8_t priority)
 {
-	uint32_t* pPSP;
+	int task_id = -1;
+
+	if((entry == NULL) || (priority >= MAX_PRIORITIES) || (stack_size == 0) || (stack_size > TASK_STACK_MAX))
+		return -1;
+
+	INTERRUPT_DISABLE();
 
-	user_tasks[0].task_handler = idle_handler;
-	user_tasks[1].task_handler = task1_handler;
-	user_tasks[2].task_handler = task2_handler;
-	user_tasks[3].task_handler = task3_handler;
-	user_tasks[4].task_handler = task4_handler;
+	reclaim_zombie_task();
 
-	for(int i =0; i < MAX_TASKS; i++)
+	for(int i = 0; i < MAX_TASKS; i++)
 	{
-		user_tasks[i].current_state = TASK_READY_STATE;
-		user_tasks[i].psp_value = PSP_INIT_ADDRS[i];
-		pPSP = (uint32_t*) user_tasks[i].psp_value;
+		if(!TASK_IN_USE(&user_tasks[i]))
+		{
+			task_id = i;
+			break;
+		}
+	}
+
+	// Level 0 is idle's alone: tickless idle sleeps whenever idle is picked,
+	// which would starve any peer sharing its level for seconds
+	if((priority == IDLE_PRIORITY) && (task_id > 0))
+		task_id = -1;
+
+	uint32_t base = (task_id < 0) ? 0 : stack_pool_alloc(stack_size);
+	if(base != 0)
+	{
+		TCB_t* tcb = &user_tasks[task_id];
+
+		// Nothing of a previous occupant survives (EDF deadline, miss count,
+		// statistics): a stale past deadline would outrank every task. Only
+		// the generation carries over, so a scan in flight can tell.
+#if USE_STACK_WATERMARK
+		uint16_t generation = tcb->generation;
+#endif
+		memset(tcb, 0, sizeof(*tcb));
+#if USE_STACK_WATERMARK
+		tcb->generation = generation + 1U;
+#endif
+		tcb->priority = priority;
+		tcb->stack_base = base;
+		tcb->stack_size = (uint16_t)STACK_ROUND(stack_size);
+#if USE_MPU_STACK_GUARD
+		tcb->mpu_guard_rbar = base | (1U << MPU_RBAR_VALID_BIT) | MPU_GUARD_REGION;
+#endif
+#if USE_STACK_WATERMARK
+		stack_paint(tcb);
+#endif
+		init_task_frame(tcb, entry, arg);
+
+		tcb->flags = TASK_FLAG_USED;
+		ready_list_append(tcb);
+
+		// A new task that outranks the caller runs right away
+		if(g_scheduler_started && (pick_next_task() != g_current_tcb))
+			schedule();
+	}
+	else
+	{
+		task_id = -1; // No free TCB or no stack space
+	}
 
-		pPSP--; // PSR
-		*pPSP = DUMMY_XPSR;//0x01000000
+	INTERRUPT_ENABLE();
+
+	return task_id;
+}
+
+void sys_task_delete(int task_id)
+{
+	INTERRUPT_DISABLE();
+
+	// There is only one zombie slot: release the previous self-deleted task
+	// (already switched away from) before this call may record a new one
+	reclaim_zombie_task();
+
+	if(task_id < 0)
+		task_id = (int)(g_current_tcb - user_tasks);
 
-		pPSP--; // PC
-		*pPSP = (uint32_t) user_tasks[i].task_handler;
+	TCB_t* tcb = &user_tasks[task_id];
 
-		pPSP--; // LR
-		/*
-		 * Table 2-17 Exception return behavior
-		 * Return to Thread mode, exception return uses
-		 * non-floating-point state from
-		 * the PSP and execution uses PSP after return.
-		 */
-		*pPSP = 0xFFFFFFFD;
+	// Idle is the scheduler's fallback and can never go away
+	if((task_id == 0) || (task_id >= MAX_TASKS) || !TASK_IN_USE(tcb) || (tcb->flags & TASK_FLAG_DELETED))
+	{
+		INTERRUPT_ENABLE();
+		return;
+	}
 
-		// R12, R3, R2, R1, R0 (auto‑popped on exception return)
-		for (int j = 0; j < 5; ++j) { *--pPSP = 0; }
-		// R4‑R11 (manually pushed/popped by PendSV)
-		for (int j = 0; j < 8; ++j) { *--pPSP = 0; }
+	if(tcb->flags & TASK_FLAG_BLOCKED)
+		timer_wheel_remove(tcb);
+	else
+		ready_list_remove(tcb);
 
-		user_tasks[i].psp_value = (uint32_t)pPSP;
+	if(tcb == g_current_tcb)
+	{
+		// Still executing on this stack: released once PendSV has switched away
+		tcb->flags |= TASK_FLAG_DELETED;
+		g_zombie_task = task_id;
+	}
+	else
+	{
+		stack_pool_free(tcb->stack_base, tcb->stack_size);
+		tcb->flags = 0;
 	}
+
+	if(g_scheduler_started)
+		schedule();
+
+	INTERRUPT_ENABLE();
 }
 
-uint32_t get_psp_value(void)
+void task_exit(void)
 {
-	return user_tasks[current_task].psp_value;
+	// Tasks that return from their entry function land here (stacked LR)
+	task_delete(-1);
+	for(;;);
 }
 
-__attribute__((naked)) void switch_sp_to_psp(void)
+void init_task_frame(TCB_t* tcb, void (*entry)(void*), void* arg)
 {
-	// 1. Initialize PSP with Task 1 stack start address
+	uint32_t* pPSP = (uint32_t*)(tcb->stack_base + tcb->stack_size);
 
-	// Get PSP of current task
-	// Branch with link
-	// Returns to this function after called function executes
-	// Return value is stored in R0 register
-	__asm volatile("PUSH {LR}"); // Preserve LR which connects back to main()
-	__asm volatile("BL get_psp_value"); // LR updated by BL command
-	__asm volatile("MSR PSP,R0"); // initialize PSP
-	__asm volatile("POP {LR}"); // pops back LR value
+	pPSP--; // PSR
+	*pPSP = DUMMY_XPSR;//0x01000000
 
-	// 2. Change SP to PSP using CONTROL register
-	// Set SPSEL bit (2nd bit) as 1 for PSP
-	__asm volatile("MOV R0,#0x02");
-	__asm volatile("MSR CONTROL,R0");
-	__asm volatile("BX LR");
+	pPSP--; // PC (exception return wants bit 0 clear)
+	*pPSP = ((uint32_t) entry) & ~0x1UL;
+
+	pPSP--; // LR: where the task goes if its entry function returns
+	*pPSP = (uint32_t) task_exit;
+
+	// R12, R3, R2, R1 (auto‑popped on exception return)
+	for (int j = 0; j < 4; ++j) { *--pPSP = 0; }
+	// R0: the entry function's argument
+	*--pPSP = (uint32_t) arg;
+	// EXC_RETURN, then R4‑R11 (manually pushed/popped by PendSV). A new task
+	// starts with an integer-only frame; the core switches to an extended
+	// frame by itself the first time the task touches the FPU.
+	*--pPSP = EXC_RETURN_THREAD_PSP;
+	for (int j = 0; j < 8; ++j) { *--pPSP = 0; }
+
+	tcb->psp_value = (uint32_t)pPSP;
 }
 
-void save_psp_value(uint32_t current_psp)
+uint32_t stack_pool_alloc(uint32_t size)
 {
-	user_tasks[current_task].psp_value = current_psp;
+	uint32_t blocks = (size + STACK_BLOCK_SIZE - 1U) / STACK_BLOCK_SIZE;
+	uint32_t run = 0;
+
+	// First fit: find `blocks` consecutive free blocks
+	for(uint32_t b = 0; b < STACK_POOL_BLOCKS; b++)
+	{
+		if(stack_pool_map[b / 32U] & (1UL << (b % 32U)))
+		{
+			run = 0;
+			continue;
+		}
+
+		if(++run == blocks)
+		{
+			uint32_t first = b + 1U - blocks;
+			for(uint32_t i = first; i <= b; i++)
+				stack_pool_map[i / 32U] |= (1UL << (i % 32U));
+			return STACK_POOL_START + (first * STACK_BLOCK_SIZE);
+		}
+	}
+
+	return 0;
 }
 
-void update_current_task(void)
+KERNEL_RAMFUNC void stack_pool_free(uint32_t base, uint32_t size)
 {
-	int state = TASK_BLOCKED_STATE;
+	uint32_t first = (base - STACK_POOL_START) / STACK_BLOCK_SIZE;
 
-	for(int i= 0 ; i < (MAX_TASKS) ; i++)
+	for(uint32_t i = first; i < first + (size / STACK_BLOCK_SIZE); i++)
+		stack_pool_map[i / 32U] &= ~(1UL << (i % 32U));
+}
+
+#if USE_STACK_WATERMARK
+void stack_paint(TCB_t* tcb)
+{
+	uint32_t* p = (uint32_t*)(tcb->stack_base + STACK_PAINT_OFFSET);
+	uint32_t* end = (uint32_t*)(tcb->stack_base + tcb->stack_size);
+
+	while(p < end)
+		*p++ = STACK_PAINT_PATTERN;
+
+	tcb->stack_unused = tcb->stack_size - STACK_PAINT_OFFSET;
+}
+
+uint32_t stack_unused_bytes(uint32_t base, uint32_t limit)
+{
+	// The stack grows down: count painted words up from the bottom, no
+	// further than the last known mark (it can only move down)
+	uint32_t* start = (uint32_t*)(base + STACK_PAINT_OFFSET);
+	uint32_t* end = start + (limit / 4U);
+	uint32_t* p = start;
+
+	while((p < end) && (*p == STACK_PAINT_PATTERN))
+		p++;
+
+	return (uint32_t)(p - start) * 4U;
+}
+
+void stack_scan_step(void)
+{
+	// One stack per call, read-only and preemptible, so idle never holds
+	// the CPU or interrupts for long
+	TCB_t* tcb = &user_tasks[g_stack_scan_task];
+
+	if(++g_stack_scan_task == MAX_TASKS)
+		g_stack_scan_task = 0;
+
+	if(!TASK_IN_USE(tcb))
+		return;
+
+	uint16_t generation = tcb->generation;
+	uint32_t unused = stack_unused_bytes(tcb->stack_base, tcb->stack_unused);
+
+	stack_unused_lower(tcb, generation, unused);
+}
+
+void stack_unused_lower(TCB_t* tcb, uint16_t generation, uint32_t unused)
+{
+	uint32_t mark;
+	uint32_t failed;
+
+	// Discard the result if the slot was deleted and recreated meanwhile
+	// (first fit often hands out the same stack base again, so only the
+	// generation tells). Idle may run unprivileged and cannot mask
+	// interrupts: the exclusive pair closes the window between check and
+	// store instead, as any exception in between fails the STREXH.
+	do
 	{
-		current_task++;
-		current_task %= MAX_TASKS;
-		state = user_tasks[current_task].current_state;
-		if( (state == TASK_READY_STATE) && (current_task != 0) )
-			break;
+		__asm volatile("LDREXH %0,[%1]" : "=r"(mark) : "r"(&tcb->stack_unused) : "memory");
+		if((tcb->generation != generation) || (unused >= mark))
+		{
+			__asm volatile("CLREX" : : : "memory");
+			return;
+		}
+		__asm volatile("STREXH %0,%2,[%1]" : "=&r"(failed) : "r"(&tcb->stack_unused), "r"(unused) : "memory");
+	} while(failed != 0);
+}
+
+uint32_t task_stack_high_water(int task_id)
+{
+	if((task_id < 0) || (task_id >= MAX_TASKS) || !TASK_IN_USE(&user_tasks[task_id]))
+		return 0;
+
+	TCB_t* tcb = &user_tasks[task_id];
+	uint16_t generation = tcb->generation;
+
+	stack_unused_lower(tcb, generation, stack_unused_bytes(tcb->stack_base, tcb->stack_unused));
+
+	return tcb->stack_size - STACK_PAINT_OFFSET - tcb->stack_unused;
+}
+#endif
+
+void start_scheduler(void)
+{
+	// Deterministic boot: the first task is whatever the policy picks, started
+	// from the frame task_create() prepared for it
+	INTERRUPT_DISABLE();
+	g_current_tcb = g_next_tcb = pick_next_task();
+#if PENDSV_BASELINE_CALLS
+	g_current_task = (uint32_t)(g_current_tcb - user_tasks);
+#endif
+#if USE_MPU_STACK_GUARD
+	mpu_init();
+#endif
+	init_systick_timer(TICK_HZ);
+
+	// Drop everything main() left on MSP, then SVC #0 (R0 = clean MSP top):
+	// SVC_Handler sets g_scheduler_started and exception-returns straight into
+	// the first task. One asm statement, so the compiler cannot touch the
+	// stack in between.
+	__asm volatile("MOV R0,%0\n\t"
+			"MSR MSP,R0\n\t"
+			"CPSIE I\n\t"
+			"SVC #0" : : "r"(SCHED_STACK_START) : "r0", "memory");
+}
+
+#if !USE_SST_KERNEL
+__attribute__((naked)) void SVC_Handler(void)
+{
+	// From a task (EXC_RETURN on PSP): system call, tail-called so that
+	// svc_dispatch() exception-returns straight to the caller
+	__asm volatile("TST LR,#4");
+	__asm volatile("ITT NE");
+	__asm volatile("MRSNE R0,PSP");
+	__asm volatile("BNE svc_dispatch");
+
+	// On MSP: the caller was not a task. Either start_scheduler()'s SVC #0
+	// (Thread mode, still on MSP as no task exists yet) or an SVC from a
+	// lower-priority ISR (Handler mode, nested). Launch only for the former,
+	// i.e. SVC #0 while g_scheduler_started is 0; return from anything else
+	// untouched, as a launch would run g_current_tcb over the interrupted code.
+	__asm volatile("MRS R1,MSP");
+	__asm volatile("LDR R2,[R1,#24]"); // Stacked PC
+	__asm volatile("LDRB R2,[R2,#-2]"); // SVC immediate
+	__asm volatile("MOVW R3,#:lower16:g_scheduler_started");
+	__asm volatile("MOVT R3,#:upper16:g_scheduler_started");
+	__asm volatile("LDRB R1,[R3]");
+	__asm volatile("ORRS R1,R1,R2");
+	__asm volatile("IT NE");
+	__asm volatile("BXNE LR");
+	__asm volatile("MOVS R1,#1");
+	__asm volatile("STRB R1,[R3]");
+
+	// Launch the first task. R0 = top of the scheduler stack, so the
+	// handler's own frame is discarded too and MSP starts out empty.
+	__asm volatile("MSR MSP,R0");
+
+	// Restore half of PendSV_Handler for g_current_tcb
+	__asm volatile("MOVW R1,#:lower16:g_current_tcb");
+	__asm volatile("MOVT R1,#:upper16:g_current_tcb");
+	__asm volatile("LDR R2,[R1]");
+	__asm volatile("LDR R0,[R2]");
+	__asm volatile("LDMIA R0!,{R4-R11,LR}"); // LR = EXC_RETURN_THREAD_PSP
+	__asm volatile("MSR PSP,R0");
+
+#if USE_UNPRIVILEGED_TASKS
+	// Thread mode drops privilege for good; CONTROL is shared by all tasks
+	__asm volatile("MRS R1,CONTROL");
+	__asm volatile("ORR R1,R1,#1");
+	__asm volatile("MSR CONTROL,R1");
+#endif
+
+	__asm volatile("BX LR"); // Thread mode on PSP: pops R0 (arg), PC = entry
+}
+#endif
+
+void svc_dispatch(uint32_t* frame)
+{
+	// frame: R0-R3, R12, LR, PC, xPSR stacked by the SVC; the number is the
+	// immediate of the SVC instruction just before the stacked PC
+	KSTATS_BEGIN(svc_start);
+	uint8_t svc_number = ((uint8_t*)frame[6])[-2];
+
+	switch(svc_number)
+	{
+	case SVC_TASK_DELAY:
+		sys_task_delay(frame[0]);
+		break;
+	case SVC_TASK_DELAY_UNTIL:
+		frame[0] = sys_task_delay_until(frame[0], frame[1]);
+		break;
+	case SVC_TASK_YIELD:
+		sys_task_yield();
+		break;
+	case SVC_TASK_CREATE:
+		frame[0] = (uint32_t)sys_task_create((void (*)(void*))frame[0], (void*)frame[1],
+				frame[2], (uint8_t)frame[3]);
+		break;
+	case SVC_TASK_DELETE:
+		sys_task_delete((int)frame[0]);
+		break;
+	default:
+		break;
 	}
 
-	if(state == TASK_BLOCKED_STATE)
-		current_task = 0; // Only idle is runnable
+	KSTATS_END(svc, svc_start);
+}
+
+int syscall_direct(void)
+{
+	// main() building boot tasks before the launch, or an ISR (an SVC from a
+	// handler at or above SVC priority escalates to HardFault, from a lower
+	// one it lands in SVC_Handler on MSP, which ignores it): call the body
+	// directly
+	uint32_t ipsr;
+
+	__asm volatile("MRS %0,IPSR" : "=r"(ipsr));
+	return !g_scheduler_started || (ipsr != 0);
+}
+
+int task_create(void (*entry)(void*), void* arg, uint32_t stack_size, uint8_t priority)
+{
+	if(syscall_direct())
+		return sys_task_create(entry, arg, stack_size, priority);
+	return (int)SYSCALL(SVC_TASK_CREATE, entry, arg, stack_size, priority);
+}
+
+void task_delete(int task_id)
+{
+	if(syscall_direct())
+		sys_task_delete(task_id);
+	else
+		SYSCALL(SVC_TASK_DELETE, task_id, 0, 0, 0);
+}
+
+void task_delay(uint32_t tick_count)
+{
+	if(syscall_direct())
+		return;
+	SYSCALL(SVC_TASK_DELAY, tick_count, 0, 0, 0);
+}
+
+void task_delay_until(uint32_t* last_wake, uint32_t period)
+{
+	if(syscall_direct())
+		return;
+	// The caller's variable is updated here, in Thread mode with the caller's
+	// own access rights
+	*last_wake = SYSCALL(SVC_TASK_DELAY_UNTIL, *last_wake, period, 0, 0);
+}
+
+void task_yield(void)
+{
+	if(syscall_direct())
+		return;
+	SYSCALL(SVC_TASK_YIELD, 0, 0, 0, 0);
+}
+
+KERNEL_RAMFUNC void reclaim_zombie_task(void)
+{
+	// A task that deleted itself is off its stack once PendSV switched away
+	// (its context save was the last write to it)
+	if((g_zombie_task >= 0) && (&user_tasks[g_zombie_task] != g_current_tcb))
+	{
+		stack_pool_free(user_tasks[g_zombie_task].stack_base, user_tasks[g_zombie_task].stack_size);
+		user_tasks[g_zombie_task].flags = 0;
+		g_zombie_task = -1;
+	}
 }
 
-void SysTick_Handler(void)
+KERNEL_RAMFUNC TCB_t* pick_next_task(void)
 {
+#if (SCHED_POLICY == SCHED_POLICY_EDF)
+	// Earliest absolute deadline first; tasks without a period (idle,
+	// aperiodic work) run by priority only when no deadline work is ready
+	if(edf_ready_list != NULL)
+		return edf_ready_list;
+#endif
+
+	// Highest non-empty level wins; idle sits at level 0 and never blocks,
+	// so the mask is never empty
+	uint32_t top = 31U - __builtin_clz(g_ready_mask);
+	return ready_lists[top].head;
+}
+
+KERNEL_RAMFUNC void ready_list_append(TCB_t* tcb)
+{
+	ready_list_t* list = &ready_lists[tcb->priority];
+
+#if (SCHED_POLICY == SCHED_POLICY_EDF)
+	if(tcb->period != 0)
+	{
+		edf_list_insert(tcb);
+		return;
+	}
+#endif
+
+	tcb->next = NULL;
+	tcb->prev = list->tail;
+	if(list->tail != NULL)
+		list->tail->next = tcb;
+	else
+		list->head = tcb;
+	list->tail = tcb;
+
+	g_ready_mask |= (1UL << tcb->priority);
+}
+
+KERNEL_RAMFUNC void ready_list_remove(TCB_t* tcb)
+{
+	ready_list_t* list = &ready_lists[tcb->priority];
+
+#if (SCHED_POLICY == SCHED_POLICY_EDF)
+	if(tcb->period != 0)
+	{
+		edf_list_remove(tcb);
+		return;
+	}
+#endif
+
+	if(tcb->prev != NULL)
+		tcb->prev->next = tcb->next;
+	else
+		list->head = tcb->next;
+	if(tcb->next != NULL)
+		tcb->next->prev = tcb->prev;
+	else
+		list->tail = tcb->prev;
+	tcb->next = tcb->prev = NULL;
+
+	if(list->head == NULL)
+		g_ready_mask &= ~(1UL << tcb->priority);
+}
+
+#if (SCHED_POLICY == SCHED_POLICY_EDF)
+KERNEL_RAMFUNC void edf_list_insert(TCB_t* tcb)
+{
+	TCB_t* prev = NULL;
+	TCB_t* node = edf_ready_list;
+
+	// Sorted by absolute deadline (wrap-safe); equal deadlines stay FIFO
+	while((node != NULL) && !TICK_BEFORE(tcb->deadline, node->deadline))
+	{
+		prev = node;
+		node = node->next;
+	}
+
+	tcb->prev = prev;
+	tcb->next = node;
+	if(node != NULL)
+		node->prev = tcb;
+	if(prev != NULL)
+		prev->next = tcb;
+	else
+		edf_ready_list = tcb;
+}
+
+KERNEL_RAMFUNC void edf_list_remove(TCB_t* tcb)
+{
+	if(tcb->prev != NULL)
+		tcb->prev->next = tcb->next;
+	else
+		edf_ready_list = tcb->next;
+	if(tcb->next != NULL)
+		tcb->next->prev = tcb->prev;
+	tcb->next = tcb->prev = NULL;
+}
+#endif
+
+#if !USE_SST_KERNEL
+KERNEL_RAMFUNC void SysTick_Handler(void)
+{
+	KSTATS_BEGIN(systick_start);
+#if USE_KERNEL_STATS
+	g_tick_stamp = systick_start;
+#endif
+	uint32_t slept = g_tickless_ticks;
+
+	// End of a tickless sleep: account for the ticks that passed silently
+	if(g_tickless_ticks != 0)
+	{
+		tickless_catch_up(g_tickless_ticks - 1U);
+		g_tickless_ticks = 0;
+	}
+
 	update_global_tick_count();
-	unblock_tasks();
+	KSTATS_BEGIN(unblock_start);
+	uint32_t woken = unblock_tasks();
+	KSTATS_END(unblock, unblock_start);
 
-	// Pend the PendSV Exception
-	// Request a context switch after ISR completes
-	uint32_t* pICSR = (uint32_t*)ICSR_ADDR;
-	*pICSR |= (1 << PENDSVSET_BIT);
+	TCB_t* running = g_current_tcb;
+
+#if TIME_SLICE_TICKS
+	// Quantum used up: queue the running task behind its equal-priority peers
+	// (EDF tasks are ordered by deadline instead and never rotate)
+	if(--g_slice_left == 0)
+	{
+		ready_list_t* list = &ready_lists[running->priority];
+
+		g_slice_left = TIME_SLICE_TICKS;
+		if(TASK_IS_READY(running) && !TCB_USES_EDF(running) && (list->head != list->tail))
+		{
+			ready_list_remove(running);
+			ready_list_append(running);
+		}
+	}
+#endif
+
+	// Request a context switch only if the quantum rotated the running task
+	// out or a more urgent task became ready; equal priorities queue behind
+	// it in FIFO order until its quantum ends
+	if(pick_next_task() != running)
+	{
+		schedule();
+	}
+	else
+	{
+		g_pendsv_avoided++;
+#if USE_TICKLESS_IDLE
+		// No switch back through schedule(): go back to sleep here
+		if(running == &user_tasks[0])
+			tickless_enter();
+#endif
+	}
+
+	// A tick that woke nothing (and ended no tickless sleep) must cost the
+	// same at any task count; it is the same sample as systick, so neither
+	// includes the other's recording
+	KSTATS_END_ALSO_IF(systick, (woken == 0) && (slept == 0), quiet, systick_start);
 }
+#endif
 
-__attribute__((naked)) void PendSV_Handler(void)
+#if !USE_SST_KERNEL
+__attribute__((naked)) KERNEL_RAMFUNC void PendSV_Handler(void)
 {
+#if USE_KERNEL_STATS
+	__asm volatile("PUSH {R0,LR}"); // Keep EXC_RETURN (and 8-byte alignment)
+	__asm volatile("BL pendsv_stats_enter");
+	__asm volatile("POP {R0,LR}");
+#endif
+
+	// R1 = &g_current_tcb, R2 = current TCB, R3 = &g_next_tcb, R12 = next TCB
+	__asm volatile("MOVW R1,#:lower16:g_current_tcb");
+	__asm volatile("MOVT R1,#:upper16:g_current_tcb");
+	__asm volatile("MOVW R3,#:lower16:g_next_tcb");
+	__asm volatile("MOVT R3,#:upper16:g_next_tcb");
+	__asm volatile("LDR R2,[R1]");
+	__asm volatile("LDR R12,[R3]");
+
+	// Fast exit: the selected task is the one already running, nothing to swap
+	__asm volatile("CMP R2,R12");
+	__asm volatile("BNE 1f");
+	__asm volatile("MOVW R0,#:lower16:g_pendsv_same_task");
+	__asm volatile("MOVT R0,#:upper16:g_pendsv_same_task");
+	__asm volatile("LDR R2,[R0]");
+	__asm volatile("ADDS R2,R2,#1");
+	__asm volatile("STR R2,[R0]");
+#if USE_KERNEL_STATS
+	__asm volatile("PUSH {R0,LR}");
+	__asm volatile("BL pendsv_stats_exit");
+	__asm volatile("POP {R0,LR}");
+#endif
+	__asm volatile("BX LR");
+	__asm volatile("1:");
+
 	// Save content of current task
 
 	// 1. Get current running task's PSP value
 	__asm volatile("MRS R0,PSP");
-	// 2. Using the PSP value, store SF2 (R4 to R11)
-	// Push R4 through R11 onto the stack that grows down,
+#if USE_FPU_CONTEXT
+	// 2. Task has live FP state (EXC_RETURN bit 4 clear): save S16-S31 too.
+	// Integer-only tasks skip this, and with lazy stacking S0-S15 are only
+	// written if this VSTMDB (or the next task's FP use) needs them.
+	__asm volatile("TST LR,#0x10");
+	__asm volatile("IT EQ\n\tVSTMDBEQ R0!,{S16-S31}");
+#endif
+	// 3. Using the PSP value, store SF2 (R4 to R11) and this task's EXC_RETURN
+	// Push R4 through R11 and LR onto the stack that grows down,
 	// starting just below the current address in R0,
 	// and update R0 to the new stack pointer afterward.
-	__asm volatile("STMDB R0!,{R4-R11}");
+	__asm volatile("STMDB R0!,{R4-R11,LR}");
 
-	// Save LR
-	__asm volatile("PUSH {LR}");
-
-	// 3. Save the current value of PSP
+#if PENDSV_BASELINE_CALLS
+	// Old path, for comparison: LR is already on the task stack, so the
+	// calls may clobber it; R0 = PSP in, next task's PSP out
 	__asm volatile("BL save_psp_value");
-
-	// Retrieve the context of next task
-	// 1. Decide the next task to run
 	__asm volatile("BL update_current_task");
-	// 2. Get its past PSP value
 	__asm volatile("BL get_psp_value");
+#else
+	// 4. current->psp_value = R0 (psp_value is at offset 0)
+	__asm volatile("STR R0,[R2]");
+
+	// Retrieve the context of next task (already chosen by schedule())
+	// 1. g_current_tcb = g_next_tcb
+	__asm volatile("STR R12,[R1]");
+#if USE_MPU_STACK_GUARD
+	// Move the guard under the next task's stack: RBAR with VALID selects
+	// the guard region and sets its base; size/attributes never change
+	__asm volatile("LDR R2,[R12,#4]");
+	__asm volatile("MOVW R3,#0xED9C"); // MPU_RBAR_REG
+	__asm volatile("MOVT R3,#0xE000");
+	__asm volatile("STR R2,[R3]");
+	__asm volatile("DSB");
+	__asm volatile("ISB");
+#endif
+	// 2. Get its past PSP value
+	__asm volatile("LDR R0,[R12]");
+#endif
 
-	// 3. Using that PSP value retrieve SF2 (R4 to R11)
+	// 3. Using that PSP value retrieve SF2 (R4 to R11) and its EXC_RETURN
 	// Load multiple registers, increment after
-	__asm volatile("LDMIA R0!,{R4-R11}");
+	__asm volatile("LDMIA R0!,{R4-R11,LR}");
+#if USE_FPU_CONTEXT
+	__asm volatile("TST LR,#0x10");
+	__asm volatile("IT EQ\n\tVLDMIAEQ R0!,{S16-S31}");
+#endif
 
 	// 4. Update PSP and exit
 	__asm volatile("MSR PSP,R0");
 
-	__asm volatile("POP {LR}");
+#if USE_KERNEL_STATS
+	__asm volatile("PUSH {R0,LR}");
+	__asm volatile("BL pendsv_stats_exit");
+	__asm volatile("POP {R0,LR}");
+#endif
+
+	__asm volatile("BX LR"); // Exception return → next task (its own frame type)
+}
+#endif
+
+#if PENDSV_BASELINE_CALLS
+KERNEL_RAMFUNC void save_psp_value(uint32_t current_psp)
+{
+	user_tasks[g_current_task].psp_value = current_psp;
+}
+
+KERNEL_RAMFUNC void update_current_task(void)
+{
+	g_current_task = (uint32_t)(g_next_tcb - user_tasks);
+	g_current_tcb = &user_tasks[g_current_task];
+#if USE_MPU_STACK_GUARD
+	*(uint32_t volatile*)MPU_RBAR_REG = user_tasks[g_current_task].mpu_guard_rbar;
+	__asm volatile("DSB\n\tISB" : : : "memory");
+#endif
+}
+
+KERNEL_RAMFUNC uint32_t get_psp_value(void)
+{
+	return user_tasks[g_current_task].psp_value;
+}
+#endif
+
+#if USE_KERNEL_STATS
+uint32_t g_pendsv_stamp = 0;
 
-	__asm volatile("BX LR"); // Exception return → next task
+KERNEL_RAMFUNC void pendsv_stats_enter(void)
+{
+	g_pendsv_stamp = kstats_now();
 }
 
-void unblock_tasks(void)
+KERNEL_RAMFUNC void pendsv_stats_exit(void)
 {
-	for(int i=0; i< MAX_TASKS; i++)
+	uint32_t now = kstats_now();
+	TCB_t* tcb = g_current_tcb;
+
+	kstats_record(&g_kstats.pendsv, now - g_pendsv_stamp);
+
+	// First time on the CPU since a tick woke it: tick-to-run latency
+	if(tcb->wake_stamp != 0)
 	{
-		if(user_tasks[i].current_state != TASK_READY_STATE)
-		{
-			if(user_tasks[i].block_count == g_tick_count)
-			{
-				user_tasks[i].current_state = TASK_READY_STATE;
-			}
-		}
+		uint32_t latency = now - tcb->wake_stamp;
+
+		kstats_record(&g_kstats.wakeup, latency);
+		if(latency > tcb->wake_latency_max)
+			tcb->wake_latency_max = latency;
+		tcb->wake_stamp = 0;
+	}
+}
+
+void kstats_dump_tasks(void)
+{
+	// RAM per task = TCB + its stack; per-tick and per-switch cost do not
+	// grow with the task count (bitmap ready set, timing wheel)
+	printf("TCB %lu bytes x %d slots, stack pool %lu bytes: %lu bytes RAM per task\n",
+			(unsigned long)sizeof(TCB_t), MAX_TASKS, (unsigned long)STACK_POOL_SIZE,
+			(unsigned long)((sizeof(user_tasks) + STACK_POOL_SIZE) / MAX_TASKS));
+	printf("msg pool %lu x %lu bytes: used=%lu peak=%lu failed=%lu\n",
+			(unsigned long)g_msg_pool.block_count, (unsigned long)g_msg_pool.block_size,
+			(unsigned long)g_msg_pool.used, (unsigned long)g_msg_pool.peak,
+			(unsigned long)g_msg_pool.failed);
+
+	for(int i = 0; i < MAX_TASKS; i++)
+	{
+		TCB_t* tcb = &user_tasks[i];
+
+		if(!TASK_IN_USE(tcb))
+			continue;
+
+		printf("task %d prio=%u flags=0x%02X max-wakeup=%lu ram=%lu bytes\n",
+				i, tcb->priority, tcb->flags, (unsigned long)tcb->wake_latency_max,
+				(unsigned long)(sizeof(TCB_t) + tcb->stack_size));
+#if (SCHED_POLICY == SCHED_POLICY_EDF)
+		printf("  deadline-misses=%lu\n", (unsigned long)tcb->deadline_misses);
+#endif
+#if USE_STACK_WATERMARK
+		printf("  stack %lu/%lu bytes used at peak\n",
+				(unsigned long)task_stack_high_water(i), (unsigned long)tcb->stack_size);
+#endif
+	}
+}
+#endif
+
+KERNEL_RAMFUNC uint32_t unblock_tasks(void)
+{
+	TCB_t* tcb = timer_wheel_expire(g_tick_count);
+	uint32_t woken = 0;
+
+	// Everything that was in the current level-0 slot is due this tick
+	while(tcb != NULL)
+	{
+		TCB_t* next = tcb->next;
+
+		tcb->flags &= ~TASK_FLAG_BLOCKED;
+		ready_list_append(tcb);
+#if USE_KERNEL_STATS
+		tcb->wake_stamp = g_tick_stamp | 1U; // Never 0 (= none pending); 1 cycle bias at most
+#endif
+		tcb = next;
+		woken++;
 	}
+
+	return woken;
 }
 
-void update_global_tick_count(void)
+KERNEL_RAMFUNC void tickless_enter(void)
+{
+	if(g_tickless_ticks != 0)
+		return; // Already asleep
+
+	uint32_t idle_ticks = timer_wheel_next_expiry();
+	if(idle_ticks > TICKLESS_MAX_TICKS)
+		idle_ticks = TICKLESS_MAX_TICKS;
+	if(idle_ticks < TICKLESS_MIN_IDLE_TICKS)
+		return;
+
+	uint32_t volatile* pSysCsr = (uint32_t*)SYST_CSR_ADDR;
+	uint32_t volatile* pSysCvr = (uint32_t*)SYST_CVR_ADDR;
+	uint32_t volatile* pICSR = (uint32_t*)ICSR_ADDR;
+
+	*pSysCsr &= ~(0x1 << 0); // Stop the count while reprogramming
+
+	// A tick that already expired must be served by SysTick_Handler first
+	if(*pICSR & (1 << PENDSTSET_BIT))
+	{
+		*pSysCsr |= (0x1 << 0);
+		return;
+	}
+
+	// Remainder of the current tick plus whole ticks up to the wakeup
+	g_tickless_ticks = idle_ticks;
+	systick_restart(*pSysCvr + ((idle_ticks - 1U) * SYSTICK_COUNTS_PER_TICK) - 1U);
+}
+
+KERNEL_RAMFUNC void tickless_exit(void)
+{
+	uint32_t volatile* pSysCsr = (uint32_t*)SYST_CSR_ADDR;
+	uint32_t volatile* pSysCvr = (uint32_t*)SYST_CVR_ADDR;
+	uint32_t volatile* pICSR = (uint32_t*)ICSR_ADDR;
+
+	*pSysCsr &= ~(0x1 << 0);
+
+	// The sleep just ran out: SysTick_Handler does the full catch-up
+	if(*pICSR & (1 << PENDSTSET_BIT))
+	{
+		*pSysCsr |= (0x1 << 0);
+		return;
+	}
+
+	// Whole ticks left before the programmed wakeup, and how far into the
+	// current tick we are; resume normal ticking on the same tick boundary
+	uint32_t remaining = *pSysCvr;
+	uint32_t ticks_left = (remaining + SYSTICK_COUNTS_PER_TICK - 1U) / SYSTICK_COUNTS_PER_TICK;
+	uint32_t partial = remaining - ((ticks_left - 1U) * SYSTICK_COUNTS_PER_TICK);
+
+	tickless_catch_up(g_tickless_ticks - ticks_left);
+	g_tickless_ticks = 0;
+	systick_restart(partial - 1U);
+}
+
+KERNEL_RAMFUNC void tickless_catch_up(uint32_t ticks)
+{
+	// Nothing was due before the programmed wakeup, so only the cascade
+	// points (level-0 wrap) need the wheel to run
+	while(ticks-- > 0)
+	{
+		update_global_tick_count();
+		if((g_tick_count & TW_SLOT_MASK) == 0)
+			unblock_tasks();
+	}
+}
+
+KERNEL_RAMFUNC void systick_restart(uint32_t first_reload)
+{
+	uint32_t volatile* pSysRvr = (uint32_t*)SYST_RVR_ADDR;
+	uint32_t volatile* pSysCvr = (uint32_t*)SYST_CVR_ADDR;
+	uint32_t volatile* pSysCsr = (uint32_t*)SYST_CSR_ADDR;
+
+	// The first period counts first_reload; the normal tick reload is put back
+	// right after the counter has latched it, so no tick boundary is lost
+	*pSysRvr = first_reload;
+	*pSysCvr = 0; // Any write clears the count → reload on the next clock
+	*pSysCsr |= (0x1 << 0);
+	*pSysRvr = SYSTICK_COUNTS_PER_TICK - 1U;
+}
+
+KERNEL_RAMFUNC void update_global_tick_count(void)
 {
 	g_tick_count++;
 }
 
-void schedule(void)
+KERNEL_RAMFUNC void schedule(void)
 {
+	// Called with interrupts disabled (or from an ISR) whenever the READY set
+	// changes. Deciding here leaves PendSV with just a pointer swap.
+	KSTATS_BEGIN(pick_start);
+	TCB_t* next = pick_next_task();
+	KSTATS_END(pick, pick_start);
+
+	reclaim_zombie_task();
+	g_next_tcb = next;
+	g_slice_left = TIME_SLICE_TICKS; // Fresh quantum for whoever runs next
+
+#if USE_TICKLESS_IDLE
+	// Only idle can run: sleep through to the next wakeup instead of ticking.
+	// Anything else becoming ready while asleep ends the sleep early.
+	if(next == &user_tasks[0])
+		tickless_enter();
+	else if(g_tickless_ticks != 0)
+		tickless_exit();
+#endif
+
 	// Pend the PendSV Exception
 	uint32_t* pICSR = (uint32_t*)ICSR_ADDR;
 	*pICSR |= (1 << PENDSVSET_BIT);
 }
 
-void task_delay(uint32_t tick_count)
+void sys_task_delay(uint32_t tick_count)
 {
+	// A zero delay still yields for one tick (the current slot was already served)
+	if(tick_count == 0)
+		tick_count = 1;
+
 	INTERRUPT_DISABLE();
+	block_current_task(g_tick_count + tick_count);
+	INTERRUPT_ENABLE();
+}
 
-	user_tasks[current_task].block_count = g_tick_count + tick_count;
-	user_tasks[current_task].current_state = TASK_BLOCKED_STATE;
+uint32_t sys_task_delay_until(uint32_t last_wake, uint32_t period)
+{
+	INTERRUPT_DISABLE();
 
-	// Yield now (PendSV after this ISR boundary)
-	schedule();
+	// Next release is relative to the previous release, not to when this task
+	// got to run, so scheduling latency never accumulates into the period.
+	// By value in and out: the kernel never dereferences a task's pointer.
+	uint32_t wake = last_wake + period;
+
+#if (SCHED_POLICY == SCHED_POLICY_EDF)
+	TCB_t* tcb = g_current_tcb;
+
+	// The job finishing now was due by this release (implicit deadline)
+	if(TICK_BEFORE(wake, g_tick_count))
+		tcb->deadline_misses++;
+
+	// Re-file under the next job's absolute deadline
+	ready_list_remove(tcb);
+	tcb->period = period;
+	tcb->deadline = wake + period;
+	ready_list_append(tcb);
+#endif
+
+	// Wrap-safe: compare the signed distance, never the raw tick values. A
+	// release that is already due (task overran) returns without blocking.
+	if(TICK_BEFORE(g_tick_count, wake))
+		block_current_task(wake);
+	else if(pick_next_task() != g_current_tcb)
+		schedule(); // Overran, and its new deadline no longer comes first
+
+	INTERRUPT_ENABLE();
+
+	return wake;
+}
+
+void sys_task_yield(void)
+{
+	INTERRUPT_DISABLE();
+
+	// Back of its own priority level (EDF tasks re-file by deadline)
+	TCB_t* tcb = g_current_tcb;
+	ready_list_remove(tcb);
+	ready_list_append(tcb);
+
+	if(pick_next_task() != tcb)
+		schedule();
 
 	INTERRUPT_ENABLE();
 }
 
+void block_current_task(uint32_t wake_tick)
+{
+	// Called with interrupts disabled
+	TCB_t* tcb = g_current_tcb;
+
+	tcb->block_count = wake_tick;
+	tcb->flags |= TASK_FLAG_BLOCKED;
+	ready_list_remove(tcb);
+	timer_wheel_insert(tcb);
+
+	// Yield now (PendSV after this ISR boundary)
+	schedule();
+}
+
 // -----------------------------------------------------------------------------
 // Tasks
 // -----------------------------------------------------------------------------
 
-void task1_handler(void)
+#if USE_PROTOTHREAD_LEDS
+int led_blink_pt(pt_t* pt)
+{
+	const led_blink_t* blink = pt->arg;
+
+	PT_BEGIN(pt);
+	while(1)
+	{
+		led_on(blink->led);
+		PT_DELAY_UNTIL(pt, blink->period);
+		led_off(blink->led);
+		PT_DELAY_UNTIL(pt, blink->period);
+	}
+	PT_END(pt);
+}
+#endif
+
+#if USE_SST_KERNEL
+void led_blink_sst(sst_task_t* me, const sst_evt_t* e)
+{
+	led_task_t* task = (led_task_t*)me;
+
+	switch(e->sig)
+	{
+	case SST_SIG_INIT:
+		// Same grid as task_delay_until(): on at 0, toggle every period
+		sst_time_evt_init(&task->timeout, LED_SIG_TIMEOUT, me);
+		sst_time_evt_arm(&task->timeout, task->blink->period, task->blink->period);
+		led_on(task->blink->led);
+		task->on = 1;
+		break;
+
+	case LED_SIG_TIMEOUT:
+		task->on = !task->on;
+		if(task->on)
+			led_on(task->blink->led);
+		else
+			led_off(task->blink->led);
+		break;
+
+	default:
+		break;
+	}
+}
+#endif
+
+void task1_handler(void* arg)
 {
+	(void)arg;
+	uint32_t last_wake = g_tick_count;
+
 	while(1)
 	{
 		led_on(LED_GREEN);
-		task_delay(LED_GREEN_FREQ);
+		task_delay_until(&last_wake, LED_GREEN_FREQ);
 		led_off(LED_GREEN);
-		task_delay(LED_GREEN_FREQ);
+		task_delay_until(&last_wake, LED_GREEN_FREQ);
 	}
 
 }
 
-void task2_handler(void)
+void task2_handler(void* arg)
 {
+	(void)arg;
+	uint32_t last_wake = g_tick_count;
+
 	while(1)
 	{
 		led_on(LED_ORANGE);
-		task_delay(LED_ORANGE_FREQ);
+		task_delay_until(&last_wake, LED_ORANGE_FREQ);
 		led_off(LED_ORANGE);
-		task_delay(LED_ORANGE_FREQ);
+		task_delay_until(&last_wake, LED_ORANGE_FREQ);
 	}
 
 }
 
 
-void task3_handler(void)
+void task3_handler(void* arg)
 {
+	(void)arg;
+	uint32_t last_wake = g_tick_count;
+
 	while(1)
 	{
 		led_on(LED_BLUE);
-		task_delay(LED_BLUE_FREQ);
+		task_delay_until(&last_wake, LED_BLUE_FREQ);
 		led_off(LED_BLUE);
-		task_delay(LED_BLUE_FREQ);
+		task_delay_until(&last_wake, LED_BLUE_FREQ);
 	}
 
 }
 
-void task4_handler(void)
+void task4_handler(void* arg)
 {
+	(void)arg;
+	uint32_t last_wake = g_tick_count;
+
 	while(1)
 	{
 		led_on(LED_RED);
-		task_delay(LED_RED_FREQ);
+		task_delay_until(&last_wake, LED_RED_FREQ);
 		led_off(LED_RED);
-		task_delay(LED_RED_FREQ);
+		task_delay_until(&last_wake, LED_RED_FREQ);
 	}
 }
 
-void idle_handler(void)
+void idle_handler(void* arg)
 {
+	(void)arg;
+
 	while(1)
 	{
+#if USE_STACK_WATERMARK
+		stack_scan_step();
+#endif
+		// With USE_TICKLESS_IDLE this sleeps until the next task wakeup
 		__asm volatile ("wfi");
 	}
 }
@@ -366,7 +1517,12 @@ void HardFault_Handler(void)
 
 void MemManage_Handler(void)
 {
-	printf("Exception : MemManage\n");
+	uint32_t cfsr = *(uint32_t volatile*)CFSR_REG;
+	uint32_t mmfar = *(uint32_t volatile*)MMFAR_REG;
+
+	// MSTKERR (bit 4) or a data access at the guard: the running task overflowed
+	printf("Exception : MemManage (CFSR=0x%08lX MMFAR=0x%08lX task %d)\n",
+			(unsigned long)cfsr, (unsigned long)mmfar, (int)(g_current_tcb - user_tasks));
 	while(1);
 }
 
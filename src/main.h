@@ -8,49 +8,301 @@
 #ifndef MAIN_H_
 #define MAIN_H_
 
+#include <stdint.h>
+
 
 // -----------------------------------------------------------------------------
-// Task / stack layout (Top of SRAM downward)
+// Task / stack layout
 // -----------------------------------------------------------------------------
-#define MAX_TASKS 5
+// Task-count sweep (sweep.h): 0 runs the LED demo; N replaces it with idle,
+// the sweep task and N - 2 periodic load tasks, then prints kstats_dump().
+// Run it at 5, 32, 128 and 256. Needs USE_KERNEL_STATS.
+#define SWEEP_TASKS 0
+
+// Selection and tick cost are independent of the count; each slot costs one
+// compact TCB plus, beyond the boot tasks, SPARE_TASK_STACK_SIZE of pool.
+// 256 fit in SRAM (see the sweep).
+#if SWEEP_TASKS
+#define MAX_TASKS SWEEP_TASKS
+#else
+#define MAX_TASKS 8
+#endif
 
-// Some stack memory calculations
-#define SIZE_TASK_STACK 1024U
+// Some stack memory calculations (task stacks: see the per-task sizes below)
 #define SIZE_SCHED_STACK 1024U
 
 #define SRAM_START 0x20000000u
 #define SRAM_SIZE ((128) * (1024))
 #define SRAM_END ((SRAM_START) + (SRAM_SIZE))
 
-#define T1_STACK_START SRAM_END
-#define T2_STACK_START ((SRAM_END) - (1 * (SIZE_TASK_STACK)))
-#define T3_STACK_START ((SRAM_END) - (2 * (SIZE_TASK_STACK)))
-#define T4_STACK_START ((SRAM_END) - (3 * (SIZE_TASK_STACK)))
-#define IDLE_STACK_START ((SRAM_END) - (4 * (SIZE_TASK_STACK)))
-#define SCHED_STACK_START ((SRAM_END) - (5 * (SIZE_TASK_STACK)))
+#define CCMRAM_START 0x10000000u
+#define CCMRAM_SIZE ((64) * (1024))
+
+// task_create() carves stacks out of this pool in STACK_BLOCK_SIZE units;
+// task_delete() hands them back. The pool, the scheduler (MSP) stack and
+// the TCBs are ordinary linker-placed arrays (see main.c), so .bss/heap
+// growth can no longer run into them unnoticed.
+#define STACK_BLOCK_SIZE 256U
+#define STACK_ROUND(size) ((((size) + (STACK_BLOCK_SIZE) - 1U) / (STACK_BLOCK_SIZE)) * (STACK_BLOCK_SIZE))
+// Every TCB slot the boot tasks leave free gets one stack of this size in
+// the pool, so the pool grows with MAX_TASKS. Tasks created at run time may
+// ask for more as long as the total fits.
+#define SPARE_TASK_STACK_SIZE 256U
+#define STACK_POOL_SPARE (((MAX_TASKS) - (BOOT_TASK_COUNT)) * STACK_ROUND(SPARE_TASK_STACK_SIZE))
+#define STACK_POOL_SIZE ((BOOT_STACK_TOTAL) + (STACK_POOL_SPARE))
+#define STACK_POOL_BLOCKS ((STACK_POOL_SIZE) / (STACK_BLOCK_SIZE))
+
+// Put the stacks and TCBs in the 64 KB core-coupled RAM: zero wait states
+// and off the bus matrix, so context switches never contend with DMA in
+// SRAM. Needs a NOLOAD .ccm_noinit output section in CCMRAM in the linker
+// script (see README); CCM is not DMA-reachable, which stacks never need.
+#define USE_CCM_STACKS 0
+
+// -----------------------------------------------------------------------------
+// Fixed priorities (higher value = more urgent). Rate-monotonic: the shorter
+// the blink period, the higher the priority. Idle must stay at 0.
+// -----------------------------------------------------------------------------
+#define MAX_PRIORITIES 8U
+#define IDLE_PRIORITY 0U
+#define T1_PRIORITY 1U // Green, 1000 ms
+#define T2_PRIORITY 2U // Orange, 500 ms
+#define T3_PRIORITY 3U // Blue, 250 ms
+#define T4_PRIORITY 4U // Red, 125 ms
+
+// Run the four blinkers as stackless protothreads (pt.h) on one shared
+// runner stack instead of four task stacks
+#define USE_PROTOTHREAD_LEDS 0
+#define PT_RUNNER_PRIORITY T4_PRIORITY
+#define SWEEP_PRIORITY (MAX_PRIORITIES - 1U) // Above its load tasks
+
+// Alternative execution model: run-to-completion event handlers on one
+// shared MSP stack (sst.h) instead of PSP tasks switched by PendSV
+#define USE_SST_KERNEL 0
+
+// Fixed-block pool for messages between tasks/ISRs (mempool.h)
+#define MSG_POOL_BLOCK_SIZE 32U
+#define MSG_POOL_BLOCKS 16U
+
+// -----------------------------------------------------------------------------
+// Per-task stack sizes in bytes, rounded up to STACK_BLOCK_SIZE by the pool.
+// Tune them with task_stack_high_water(); the MPU guard takes the lowest 32.
+// -----------------------------------------------------------------------------
+#define IDLE_STACK_SIZE 256U // WFI loop: little more than one exception frame
+#define T1_STACK_SIZE 512U
+#define T2_STACK_SIZE 512U
+#define T3_STACK_SIZE 512U
+#define T4_STACK_SIZE 512U
+#define PT_RUNNER_STACK_SIZE 1024U
+#define SWEEP_STACK_SIZE 1024U // printf
+
+// Tasks main() creates, in order: X(entry, stack size, priority). Idle must
+// come first: it is task 0, the scheduler's fallback. main.c's boot task
+// table and the pool's share for boot stacks are both built from this list.
+#if SWEEP_TASKS
+#define BOOT_TASKS(X) \
+	X(idle_handler, IDLE_STACK_SIZE, IDLE_PRIORITY) \
+	X(sweep_task, SWEEP_STACK_SIZE, SWEEP_PRIORITY)
+#elif USE_PROTOTHREAD_LEDS
+#define BOOT_TASKS(X) \
+	X(idle_handler, IDLE_STACK_SIZE, IDLE_PRIORITY) \
+	X(pt_runner_task, PT_RUNNER_STACK_SIZE, PT_RUNNER_PRIORITY)
+#else
+#define BOOT_TASKS(X) \
+	X(idle_handler, IDLE_STACK_SIZE, IDLE_PRIORITY) \
+	X(task1_handler, T1_STACK_SIZE, T1_PRIORITY) \
+	X(task2_handler, T2_STACK_SIZE, T2_PRIORITY) \
+	X(task3_handler, T3_STACK_SIZE, T3_PRIORITY) \
+	X(task4_handler, T4_STACK_SIZE, T4_PRIORITY)
+#endif
+#define BOOT_TASK_ONE(entry, stack_size, priority) + 1U
+#define BOOT_TASK_STACK(entry, stack_size, priority) + STACK_ROUND(stack_size)
+#define BOOT_TASK_COUNT (0U BOOT_TASKS(BOOT_TASK_ONE))
+#define BOOT_STACK_TOTAL (0U BOOT_TASKS(BOOT_TASK_STACK))
+
+// Scheduling policy. Under EDF, tasks that pace themselves with
+// task_delay_until() run earliest-absolute-deadline first (deadline = next
+// release, i.e. one period after the current one); idle and other tasks
+// without a period run by fixed priority whenever no deadline work is ready.
+#define SCHED_POLICY_FIXED_PRIO 0
+#define SCHED_POLICY_EDF 1
+#define SCHED_POLICY SCHED_POLICY_FIXED_PRIO
 
 #define TICK_HZ 1000U
+
+// Round-robin quantum (ticks) among READY tasks of equal priority, so a
+// CPU-bound task cannot starve its peers. 0 disables time slicing.
+#define TIME_SLICE_TICKS 10U
+
+// Timing wheel for task_delay() wakeups: TW_LEVELS levels of TW_SLOTS slots.
+// Level 0 resolves single ticks (1/TICK_HZ s, 32 ms span at 1 kHz); every
+// level above is TW_SLOTS times coarser. 7 x 5 bits covers any 32-bit delay.
+#define TW_SLOT_BITS 5U
+#define TW_SLOTS (1U << TW_SLOT_BITS)
+#define TW_SLOT_MASK (TW_SLOTS - 1U)
+#define TW_LEVELS 7U
 #define HSI_CLOCK 16000000U
+// Memory-mapped 32-bit register at addr
+#define REG32(addr) (*(volatile uint32_t *)(addr))
 #define SYSTICK_TIM_CLK HSI_CLOCK
 #define SYST_RVR_ADDR 0xE000E014
 #define SYST_CSR_ADDR 0xE000E010
+#define SYST_CVR_ADDR 0xE000E018
 #define ICSR_ADDR 0xE000ED04
 #define PENDSVSET_BIT 28
 #define PENDSVCLR_BIT 27
+#define PENDSTSET_BIT 26
+
+#define SYSTICK_COUNTS_PER_TICK ((SYSTICK_TIM_CLK) / (TICK_HZ))
+
+// Tickless idle: while only idle_handler is runnable, SysTick is reprogrammed
+// to fire at the next wakeup (bounded by the 24-bit reload, ~1 s @ 16 MHz)
+#define USE_TICKLESS_IDLE 1
+#define TICKLESS_MIN_IDLE_TICKS 2U
+#define TICKLESS_MAX_TICKS (0x00FFFFFFUL / (SYSTICK_COUNTS_PER_TICK))
 
 #define DUMMY_XPSR 0x01000000 // T bit set
 
+// Exception return: Thread mode, PSP, basic (integer-only) frame. Bit 4
+// clear instead means the task's frame carries FP state.
+#define EXC_RETURN_THREAD_PSP 0xFFFFFFFD
+
+// Tasks run unprivileged (CONTROL.nPRIV) and reach the kernel only through
+// the SVC system calls below; 0 keeps them privileged (same call path)
+#define USE_UNPRIVILEGED_TASKS 1
+
+// SVC numbers. #0 from MSP, once, is the scheduler launch, never a system call.
+#define SVC_TASK_DELAY 1U
+#define SVC_TASK_DELAY_UNTIL 2U
+#define SVC_TASK_YIELD 3U
+#define SVC_TASK_CREATE 4U
+#define SVC_TASK_DELETE 5U
+
+// FPU context switching follows the compiler's float ABI: with hardware FP
+// (-mfpu=fpv4-sp-d16 -mfloat-abi=hard/softfp) PendSV saves S16-S31 for tasks
+// that used the FPU; lazy stacking covers S0-S15
+#if defined(__VFP_FP__) && !defined(__SOFTFP__)
+#define USE_FPU_CONTEXT 1
+#else
+#define USE_FPU_CONTEXT 0
+#endif
+#define CPACR_REG 0xE000ED88
+#define FPCCR_REG 0xE000EF34
+#define FPCCR_ASPEN_BIT 31
+#define FPCCR_LSPEN_BIT 30
+
+// Run the tick/switch path (SysTick_Handler, PendSV_Handler, unblock_tasks(),
+// schedule() and everything they call on the way: ready-list and timing-wheel
+// helpers, zombie reclaim, tickless entry/exit, kstats_record()) from SRAM
+// instead of flash, taking ART misses and wait-state jitter out of it. Relies on the
+// CubeIDE linker script's .RamFunc input section inside .data, which the
+// startup code already copies to SRAM with the rest of .data.
+#define USE_RAM_SCHEDULER 0
+#if USE_RAM_SCHEDULER
+#define KERNEL_RAMFUNC __attribute__((section(".RamFunc"), noinline))
+#else
+#define KERNEL_RAMFUNC
+#endif
+
+// Cycle-accurate instrumentation of SysTick/unblock/PendSV and wakeup
+// latency via DWT CYCCNT (see kstats.h). Costs a few cycles per path.
+#define USE_KERNEL_STATS 0
+
+// Benchmark baseline only: PendSV switches through the three calls it made
+// before the current/next TCB pointers (save_psp_value(),
+// update_current_task(), get_psp_value(), each indexing user_tasks[]).
+// Compare the pendsv path of kstats_dump() with this at 1 and at 0.
+#define PENDSV_BASELINE_CALLS 0
+
 #define SHCRS_REG 0xE000ED24
 #define MEM_MANAGE_EN_BIT 16
 #define BUS_FAULT_EN_BIT 17
 #define USAGE_FAULT_EN_BIT 18
+#define CFSR_REG 0xE000ED28
+#define MMFAR_REG 0xE000ED34
+
+// MPU stack guard: a MPU_GUARD_SIZE no-access region over the lowest bytes of
+// the running task's stack, moved by PendSV with a single RBAR write. An
+// overflow then raises a precise MemManage fault instead of corrupting the
+// neighbouring stack. Usable stack shrinks by MPU_GUARD_SIZE.
+#define USE_MPU_STACK_GUARD 1
+#define MPU_CTRL_REG 0xE000ED94
+#define MPU_RNR_REG 0xE000ED98
+#define MPU_RBAR_REG 0xE000ED9C
+#define MPU_RASR_REG 0xE000EDA0
+#define MPU_CTRL_ENABLE_BIT 0
+#define MPU_CTRL_PRIVDEFENA_BIT 2
+#define MPU_RBAR_VALID_BIT 4
+#define MPU_GUARD_REGION 7U // Highest number: wins over the SRAM region
+#define MPU_GUARD_SIZE 32U // Smallest region the Cortex-M4 MPU supports
+
+// Stack high-water marks: task_create() paints each stack with
+// STACK_PAINT_PATTERN and the idle task rescans one stack per wakeup
+#define USE_STACK_WATERMARK 1
+#define STACK_PAINT_PATTERN 0xA5A5A5A5U
+
+// Wrap-safe tick comparison: true while tick a is strictly before tick b
+// (valid for distances below 2^31 ticks, ~24 days @ 1 kHz)
+#define TICK_BEFORE(a, b)  ((int32_t)((uint32_t)(a) - (uint32_t)(b)) < 0)
 
-#define TASK_READY_STATE  0x00
-#define TASK_BLOCKED_STATE  0XFF
+// Task state, folded into TCB flags (no flag but USED: READY)
+#define TASK_FLAG_USED 0x01U // TCB slot holds a task
+#define TASK_FLAG_BLOCKED 0x02U // Sleeping on the timing wheel
+#define TASK_FLAG_DELETED 0x04U // Deleted itself; reclaimed after the next switch
 
-#define INTERRUPT_DISABLE()  do{__asm volatile ("MOV R0,#0x1"); asm volatile("MSR PRIMASK,R0"); } while(0)
+// CPSID/CPSIE set PRIMASK without a scratch register the compiler would not
+// know about; the memory clobber keeps accesses inside the critical section
+#define INTERRUPT_DISABLE()  do{__asm volatile ("CPSID I" : : : "memory"); } while(0)
 
-#define INTERRUPT_ENABLE()  do{__asm volatile ("MOV R0,#0x0"); asm volatile("MSR PRIMASK,R0"); } while(0)
+#define INTERRUPT_ENABLE()  do{__asm volatile ("CPSIE I" : : : "memory"); } while(0)
+
+// -----------------------------------------------------------------------------
+// Task API (system calls: safe from unprivileged tasks, see SVC_Handler)
+// -----------------------------------------------------------------------------
+/* Ticks since start_scheduler(), advanced by SysTick */
+extern uint32_t g_tick_count;
+
+/**
+* @brief Create a task running entry(arg) with a stack of at least stack_size
+* bytes from the stack pool. Returns the task id, or -1 when no TCB or stack
+* space is left. Priority 0 (IDLE_PRIORITY) is reserved for the idle task
+* (id 0) and refused otherwise. A task that returns from entry deletes itself.
+*/
+int task_create(void (*entry)(void*), void* arg, uint32_t stack_size, uint8_t priority);
+
+/**
+* @brief Block the caller for tick_count ticks from now (0 yields for one tick).
+*/
+void task_delay(uint32_t tick_count);
+
+/**
+* @brief Block the caller until *last_wake + period, then advance *last_wake
+* by period. Releases stay on an exact grid regardless of scheduling
+* latency; a release that is already due returns immediately. Initialize
+* *last_wake from g_tick_count once, before the loop.
+*/
+void task_delay_until(uint32_t* last_wake, uint32_t period);
+
+/**
+* @brief Move the caller behind its equal-priority peers and reschedule.
+* Only a running task can block or yield: task_delay(), task_delay_until()
+* and task_yield() return at once when called from an ISR or before
+* start_scheduler().
+*/
+void task_yield(void);
+
+#if USE_STACK_WATERMARK
+/**
+* @brief Peak number of bytes of its stack the task has used so far
+* (rescanned on each call), or 0 for an unused task id.
+*/
+uint32_t task_stack_high_water(int task_id);
+#endif
+
+/**
+* @brief Delete a task (-1: the caller) and return its stack to the pool.
+* The idle task (id 0) cannot be deleted.
+*/
+void task_delete(int task_id);
 
 
 #endif /* MAIN_H_ */
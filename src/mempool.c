@@ -0,0 +1,116 @@
+/**
+* @file mempool.c
+* @author sharan-naribole
+* @brief Lock-free fixed-block pools (LDREX/STREX free list).
+*/
+
+#include "mempool.h"
+
+
+// Exclusive load/store: STREX returns 0 on success, 1 if anything (another
+// STREX, or any exception entry/return) broke the reservation
+static inline uint32_t mempool_ldrex(uint32_t volatile* addr)
+{
+	uint32_t value;
+
+	__asm volatile("LDREX %0,[%1]" : "=r"(value) : "r"(addr) : "memory");
+	return value;
+}
+
+static inline uint32_t mempool_strex(uint32_t value, uint32_t volatile* addr)
+{
+	uint32_t failed;
+
+	__asm volatile("STREX %0,%2,[%1]" : "=&r"(failed) : "r"(addr), "r"(value) : "memory");
+	return failed;
+}
+
+static inline void mempool_clrex(void)
+{
+	__asm volatile("CLREX" : : : "memory");
+}
+
+// Atomic add; returns the new value
+static inline uint32_t mempool_atomic_add(uint32_t volatile* counter, int32_t delta)
+{
+	uint32_t value;
+
+	do
+	{
+		value = mempool_ldrex(counter) + (uint32_t)delta;
+	} while(mempool_strex(value, counter) != 0);
+
+	return value;
+}
+
+void mempool_init(mempool_t* pool)
+{
+	mempool_block_t* head = NULL;
+
+	// Build the list back to front so blocks come out in address order
+	for(uint32_t i = pool->block_count; i > 0; i--)
+	{
+		mempool_block_t* block = (mempool_block_t*)(pool->storage + (i - 1U) * pool->block_size);
+
+		block->next = head;
+		head = block;
+	}
+
+	pool->free_list = head;
+	pool->used = 0;
+	pool->peak = 0;
+	pool->failed = 0;
+}
+
+void* mempool_alloc(mempool_t* pool)
+{
+	uint32_t volatile* head_addr = (uint32_t volatile*)&pool->free_list;
+	mempool_block_t* block;
+
+	// Pop the head. Reading block->next inside the reservation is safe: if
+	// an ISR took the block meanwhile, the STREX fails and we start over.
+	do
+	{
+		block = (mempool_block_t*)mempool_ldrex(head_addr);
+		if(block == NULL)
+		{
+			mempool_clrex();
+			mempool_atomic_add(&pool->failed, 1);
+			return NULL;
+		}
+	} while(mempool_strex((uint32_t)block->next, head_addr) != 0);
+
+	uint32_t used = mempool_atomic_add(&pool->used, 1);
+	uint32_t volatile* peak_addr = &pool->peak;
+
+	// Raise the peak unless a racing alloc already pushed it higher
+	do
+	{
+		if(used <= mempool_ldrex(peak_addr))
+		{
+			mempool_clrex();
+			break;
+		}
+	} while(mempool_strex(used, peak_addr) != 0);
+
+	return block;
+}
+
+void mempool_free(mempool_t* pool, void* block)
+{
+	uint32_t volatile* head_addr = (uint32_t volatile*)&pool->free_list;
+	uint8_t* p = (uint8_t*)block;
+	mempool_block_t* node = (mempool_block_t*)block;
+
+	if((p < pool->storage) || (p >= pool->storage + pool->block_count * pool->block_size) ||
+			(((uint32_t)(p - pool->storage) % pool->block_size) != 0))
+		return;
+
+	// Push: link to the current head, retry if the head moved
+	do
+	{
+		node->next = (mempool_block_t*)mempool_ldrex(head_addr);
+	} while(mempool_strex((uint32_t)node, head_addr) != 0);
+
+	mempool_atomic_add(&pool->used, -1);
+}
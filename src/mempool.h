@@ -0,0 +1,83 @@
+/**
+* @file mempool.h
+* @author sharan-naribole
+* @brief Fixed-block memory pools with O(1), lock-free alloc/free.
+*
+* Each pool is a statically reserved array of equal-size blocks threaded
+* into a free list. mempool_alloc()/mempool_free() pop/push the list head
+* with LDREX/STREX, so they are safe from tasks (privileged or not) and
+* ISRs alike without masking interrupts. On the single-core Cortex-M4
+* every exception entry/return clears the exclusive monitor, so a
+* preempted pop always retries instead of suffering ABA.
+*
+* Blocks suit message passing between tasks: the sender allocates and
+* fills a block, the receiver frees it. Timing never depends on heap state.
+*/
+
+#ifndef MEMPOOL_H_
+#define MEMPOOL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+// -----------------------------------------------------------------------------
+// Pool definition
+// -----------------------------------------------------------------------------
+// Blocks are 8-byte aligned (doubles, uint64_t) and hold at least a pointer
+#define MEMPOOL_ALIGN 8U
+#define MEMPOOL_BLOCK_BYTES(size) \
+	((((size) < sizeof(void*) ? sizeof(void*) : (size)) + MEMPOOL_ALIGN - 1U) / MEMPOOL_ALIGN * MEMPOOL_ALIGN)
+
+typedef struct mempool_block
+{
+	struct mempool_block* next;
+} mempool_block_t;
+
+typedef struct
+{
+	mempool_block_t* volatile free_list; // LDREX/STREX target
+	uint8_t* storage;
+	uint32_t block_size; // Bytes, multiple of MEMPOOL_ALIGN
+	uint32_t block_count;
+	uint32_t volatile used; // Blocks handed out now
+	uint32_t volatile peak; // Most blocks ever out at once
+	uint32_t volatile failed; // mempool_alloc() calls that found the pool empty
+} mempool_t;
+
+/* Reserve storage for count blocks of size bytes and the pool descriptor
+   `name`. Call mempool_init(&name) once before use. */
+#define MEMPOOL_DEFINE(name, size, count) \
+	uint64_t name##_storage[(MEMPOOL_BLOCK_BYTES(size) * (count)) / sizeof(uint64_t)]; \
+	mempool_t name = \
+	{ \
+		.free_list = NULL, \
+		.storage = (uint8_t*)name##_storage, \
+		.block_size = MEMPOOL_BLOCK_BYTES(size), \
+		.block_count = (count), \
+	}
+
+
+// -----------------------------------------------------------------------------
+// API
+// -----------------------------------------------------------------------------
+/**
+* @brief Thread every block onto the free list. Call once, before the pool
+* is shared (e.g. from main() before the scheduler starts).
+*/
+void mempool_init(mempool_t* pool);
+
+/**
+* @brief Take one block, or NULL if the pool is exhausted (counted in
+* pool->failed). O(1), callable from tasks and ISRs.
+*/
+void* mempool_alloc(mempool_t* pool);
+
+/**
+* @brief Return a block obtained from the same pool. Pointers outside the
+* pool are ignored. O(1), callable from tasks and ISRs.
+*/
+void mempool_free(mempool_t* pool, void* block);
+
+
+#endif /* MEMPOOL_H_ */
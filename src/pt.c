@@ -0,0 +1,63 @@
+/**
+* @file pt.c
+* @author sharan-naribole
+* @brief Protothread runner: one PSP task executing every stackless task.
+*/
+
+#include "pt.h"
+
+#include <stddef.h>
+
+// Longest the runner sleeps when no protothread is waiting
+#define PT_RUNNER_IDLE_TICKS TICK_HZ
+
+/* Registered protothreads, only ever walked by the runner task */
+pt_t* pt_list = NULL;
+
+
+void pt_spawn(pt_t* pt, pt_func_t func, void* arg)
+{
+	pt->lc = 0;
+	pt->wake_tick = g_tick_count;
+	pt->func = func;
+	pt->arg = arg;
+	pt->next = pt_list;
+	pt_list = pt;
+}
+
+void pt_runner_task(void* arg)
+{
+	(void)arg;
+
+	while(1)
+	{
+		uint32_t now = g_tick_count;
+		uint32_t next_wake = now + PT_RUNNER_IDLE_TICKS;
+		pt_t* head = pt_list;
+		pt_t** link = &pt_list;
+
+		while(*link != NULL)
+		{
+			pt_t* pt = *link;
+
+			if(!TICK_BEFORE(now, pt->wake_tick) && pt->func(pt) == PT_EXITED)
+			{
+				*link = pt->next;
+				continue;
+			}
+
+			if(TICK_BEFORE(pt->wake_tick, next_wake))
+				next_wake = pt->wake_tick;
+			link = &pt->next;
+		}
+
+		// Sleep through to the earliest release; if one already fell due
+		// while the pass ran, or a protothread spawned another, go straight
+		// round again. The tick is read once, and the kernel gets the absolute
+		// release (now + gap), so preemption at any point here can neither wrap
+		// the gap nor stretch the sleep.
+		now = g_tick_count;
+		if(pt_list == head && TICK_BEFORE(now, next_wake))
+			task_delay_until(&now, next_wake - now);
+	}
+}
@@ -0,0 +1,85 @@
+/**
+* @file pt.h
+* @author sharan-naribole
+* @brief Stackless (protothread) tasks.
+*
+* A protothread is a resumable function that keeps its whole state in a
+* small pt_t instead of a private stack. PT_DELAY()/PT_DELAY_UNTIL() return
+* to the caller and the next call resumes right after them (a switch on
+* __LINE__, Duff's-device style). All protothreads run one after the other
+* on the stack of a single ordinary task, pt_runner_task(), so a thousand of
+* them cost one stack plus ~20 bytes each.
+*
+* Rules: local variables do NOT survive a PT_DELAY*() (keep state in pt->arg
+* or statics); no `switch` around a PT_DELAY*(); a protothread must not call
+* task_delay() or block, as that would stall every other protothread.
+*/
+
+#ifndef PT_H_
+#define PT_H_
+
+#include "main.h"
+
+#include <stdint.h>
+
+
+// -----------------------------------------------------------------------------
+// Protothread control block
+// -----------------------------------------------------------------------------
+#define PT_WAITING 0
+#define PT_EXITED 1
+
+typedef struct pt pt_t;
+typedef int (*pt_func_t)(pt_t* pt);
+
+struct pt
+{
+	uint32_t lc; // Resume point: __LINE__ of the last PT_DELAY*() (0 = start)
+	uint32_t wake_tick; // Next release (g_tick_count value)
+	pt_func_t func;
+	void* arg;
+	pt_t* next; // Runner list
+};
+
+
+// -----------------------------------------------------------------------------
+// Body macros
+// -----------------------------------------------------------------------------
+#define PT_BEGIN(pt) switch((pt)->lc) { case 0:
+
+#define PT_END(pt) } (pt)->lc = 0; return PT_EXITED
+
+/* Sleep ticks from now */
+#define PT_DELAY(pt, ticks) \
+	do { \
+		(pt)->wake_tick = g_tick_count + (ticks); \
+		(pt)->lc = __LINE__; return PT_WAITING; case __LINE__:; \
+	} while(0)
+
+/* Sleep until one period after the previous release (no drift), the
+   protothread counterpart of task_delay_until() */
+#define PT_DELAY_UNTIL(pt, period) \
+	do { \
+		(pt)->wake_tick += (period); \
+		(pt)->lc = __LINE__; return PT_WAITING; case __LINE__:; \
+	} while(0)
+
+
+// -----------------------------------------------------------------------------
+// API
+// -----------------------------------------------------------------------------
+/**
+* @brief Register pt to run func(pt) from its start on the runner's next
+* pass. pt must stay valid until func returns PT_EXITED. Call before
+* start_scheduler() or from another protothread.
+*/
+void pt_spawn(pt_t* pt, pt_func_t func, void* arg);
+
+/**
+* @brief Task entry that runs every due protothread, then sleeps until the
+* earliest wake_tick. Create it once with task_create().
+*/
+void pt_runner_task(void* arg);
+
+
+#endif /* PT_H_ */
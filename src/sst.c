@@ -0,0 +1,224 @@
+/**
+* @file sst.c
+* @author sharan-naribole
+* @brief Run-to-completion kernel: ready set, event queues, time events and
+* the PendSV/SVC pair that runs handlers in thread mode on MSP.
+*/
+
+#include "sst.h"
+
+#if USE_SST_KERNEL
+
+#include <stddef.h>
+
+#define ICSR REG32(ICSR_ADDR)
+#define SHPR3 REG32(0xE000ED20) // PendSV priority in bits 23:16
+
+// PRIMASK save/restore: sst_post() runs from tasks, ISRs and with
+// interrupts already masked
+#define SST_CRIT_ENTRY(pm) \
+	uint32_t pm; \
+	__asm volatile("MRS %0,PRIMASK\n\tCPSID I" : "=r"(pm) : : "memory")
+#define SST_CRIT_EXIT(pm) __asm volatile("MSR PRIMASK,%0" : : "r"(pm) : "memory")
+
+/* Task registered at each priority */
+sst_task_t* sst_tasks[SST_MAX_PRIO + 1U];
+
+/* Bit p set: sst_tasks[p] has queued events */
+uint32_t volatile g_sst_ready = 0;
+
+/* Priority of the handler running now (0: idle loop) */
+uint8_t volatile g_sst_curr_prio = 0;
+
+uint32_t g_sst_queue_overflows = 0;
+
+/* Armed and disarmed time events, walked every tick */
+sst_time_evt_t* sst_time_evts = NULL;
+
+const sst_evt_t sst_init_evt = { SST_SIG_INIT };
+
+void sst_activate(void);
+void sst_tick(void);
+
+
+void sst_task_start(sst_task_t* task, uint8_t priority, const sst_evt_t** queue,
+		uint8_t queue_len, sst_handler_t handler)
+{
+	task->handler = handler;
+	task->queue = queue;
+	task->queue_len = queue_len;
+	task->head = 0;
+	task->count = 0;
+	task->priority = priority;
+	sst_tasks[priority] = task;
+
+	sst_post(task, &sst_init_evt);
+}
+
+void sst_post(sst_task_t* task, const sst_evt_t* e)
+{
+	SST_CRIT_ENTRY(primask);
+
+	if(task->count == task->queue_len)
+	{
+		g_sst_queue_overflows++;
+	}
+	else
+	{
+		uint32_t tail = task->head + task->count;
+
+		if(tail >= task->queue_len)
+			tail -= task->queue_len;
+		task->queue[tail] = e;
+		task->count++;
+		g_sst_ready |= (1U << task->priority);
+
+		// Preempt right away; from an ISR this runs on exception exit
+		if(task->priority > g_sst_curr_prio)
+			ICSR |= (1U << PENDSVSET_BIT);
+	}
+
+	SST_CRIT_EXIT(primask);
+}
+
+// Entered in thread mode with interrupts masked (see PendSV_Handler), and
+// returns the same way. Runs every ready handler more urgent than the one
+// it preempted, most urgent first.
+void sst_activate(void)
+{
+	uint8_t prev = g_sst_curr_prio;
+
+	while(g_sst_ready != 0)
+	{
+		uint8_t p = 31U - __builtin_clz(g_sst_ready);
+
+		if(p <= prev)
+			break;
+
+		sst_task_t* task = sst_tasks[p];
+		const sst_evt_t* e = task->queue[task->head];
+
+		if(++task->head == task->queue_len)
+			task->head = 0;
+		if(--task->count == 0)
+			g_sst_ready &= ~(1U << p);
+
+		g_sst_curr_prio = p;
+		INTERRUPT_ENABLE();
+		task->handler(task, e);
+		INTERRUPT_DISABLE();
+	}
+
+	g_sst_curr_prio = prev;
+}
+
+// sst_activate() returns here, still in thread mode. The SVC takes us back
+// into handler mode so the frame of the preempted context can be unstacked.
+__attribute__((naked)) void sst_thread_ret(void)
+{
+#if USE_FPU_CONTEXT
+	// Clear CONTROL.FPCA so SVC stacks a basic 8-word frame
+	__asm volatile("MRS R0,CONTROL");
+	__asm volatile("BIC R0,R0,#4");
+	__asm volatile("MSR CONTROL,R0");
+	__asm volatile("ISB");
+#endif
+	__asm volatile("CPSIE I"); // SVC with PRIMASK set would escalate to HardFault
+	__asm volatile("SVC #0");
+}
+
+__attribute__((naked)) void PendSV_Handler(void)
+{
+	__asm volatile("CPSID I");
+#if USE_FPU_CONTEXT
+	__asm volatile("PUSH {R0,LR}"); // EXC_RETURN of the preempted context (+ alignment)
+#endif
+
+	// Fabricate a basic exception frame: LR = sst_thread_ret,
+	// PC = sst_activate, xPSR = Thumb. R0-R3/R12 are don't-care.
+	__asm volatile("SUB SP,SP,#(8*4)");
+	__asm volatile("MOVW R1,#:lower16:sst_thread_ret");
+	__asm volatile("MOVT R1,#:upper16:sst_thread_ret");
+	__asm volatile("MOVW R2,#:lower16:sst_activate");
+	__asm volatile("MOVT R2,#:upper16:sst_activate");
+	__asm volatile("BIC R2,R2,#1"); // Frame PC carries no Thumb bit
+	__asm volatile("MOV R3,#0x01000000");
+	__asm volatile("ADD R0,SP,#(5*4)");
+	__asm volatile("STM R0,{R1-R3}");
+
+	// Exception return to thread mode on MSP: sst_activate() runs as plain
+	// code on the shared stack, preemptible by any interrupt
+	__asm volatile("MVN R0,#6"); // 0xFFFFFFF9
+	__asm volatile("BX R0");
+}
+
+__attribute__((naked)) void SVC_Handler(void)
+{
+	// From sst_thread_ret: drop the SVC frame, leaving the original
+	// PendSV frame of the preempted context on top
+	__asm volatile("ADD SP,SP,#(8*4)");
+#if USE_FPU_CONTEXT
+	__asm volatile("POP {R0,LR}");
+	__asm volatile("DSB"); // ARM erratum 838869
+#endif
+	__asm volatile("BX LR");
+}
+
+void sst_time_evt_init(sst_time_evt_t* te, uint16_t sig, sst_task_t* task)
+{
+	te->super.sig = sig;
+	te->task = task;
+	te->ctr = 0;
+	te->interval = 0;
+
+	SST_CRIT_ENTRY(primask);
+	te->next = sst_time_evts;
+	sst_time_evts = te;
+	SST_CRIT_EXIT(primask);
+}
+
+void sst_time_evt_arm(sst_time_evt_t* te, uint32_t ticks, uint32_t interval)
+{
+	SST_CRIT_ENTRY(primask);
+	te->ctr = ticks;
+	te->interval = interval;
+	SST_CRIT_EXIT(primask);
+}
+
+void sst_tick(void)
+{
+	SST_CRIT_ENTRY(primask);
+
+	for(sst_time_evt_t* te = sst_time_evts; te != NULL; te = te->next)
+	{
+		if(te->ctr != 0 && --te->ctr == 0)
+		{
+			te->ctr = te->interval;
+			sst_post(te->task, &te->super);
+		}
+	}
+
+	SST_CRIT_EXIT(primask);
+}
+
+void SysTick_Handler(void)
+{
+	g_tick_count++;
+	sst_tick();
+}
+
+void sst_run(void)
+{
+	// PendSV below every interrupt that can post, so it only ever
+	// preempts thread mode
+	SHPR3 |= (0xFFU << 16);
+
+	INTERRUPT_ENABLE(); // Pending PendSV from the init events fires here
+
+	while(1)
+	{
+		__asm volatile("WFI");
+	}
+}
+
+#endif // USE_SST_KERNEL
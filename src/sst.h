@@ -0,0 +1,110 @@
+/**
+* @file sst.h
+* @author sharan-naribole
+* @brief Super-Simple-Tasker style run-to-completion kernel.
+*
+* An alternative to the PSP/PendSV task kernel in main.c (USE_SST_KERNEL).
+* A task is an event handler with a unique priority and a small event
+* queue. Posting an event to a task more urgent than the one running pends
+* PendSV, which calls the handler as a plain function on the one shared
+* MSP stack; a handler always returns (runs to completion) before anything
+* of lower or equal priority resumes. There are no per-task stacks and no
+* register save/restore beyond what the hardware stacks for the exception.
+*
+* Handlers must never block or busy-wait: waiting is done by arming a time
+* event and returning.
+*/
+
+#ifndef SST_H_
+#define SST_H_
+
+#include "main.h"
+
+#include <stdint.h>
+
+
+// -----------------------------------------------------------------------------
+// Events
+// -----------------------------------------------------------------------------
+#define SST_SIG_INIT 0U // Delivered once, when the task is started
+#define SST_SIG_USER 1U // First application signal
+
+typedef struct
+{
+	uint16_t sig;
+} sst_evt_t;
+
+
+// -----------------------------------------------------------------------------
+// Tasks
+// -----------------------------------------------------------------------------
+// Priorities 1 .. SST_MAX_PRIO, one task each; 0 is the idle loop in sst_run()
+#define SST_MAX_PRIO ((MAX_PRIORITIES) - 1U)
+
+typedef struct sst_task sst_task_t;
+typedef void (*sst_handler_t)(sst_task_t* me, const sst_evt_t* e);
+
+/* Embed as the first member of an application task to add per-task data */
+struct sst_task
+{
+	sst_handler_t handler;
+	const sst_evt_t** queue; // Ring buffer of queue_len event pointers
+	uint8_t queue_len;
+	uint8_t head; // Next event to dispatch
+	uint8_t count;
+	uint8_t priority;
+};
+
+
+// -----------------------------------------------------------------------------
+// Time events
+// -----------------------------------------------------------------------------
+/* Posts itself to task after ctr ticks, then every interval ticks (0: once) */
+typedef struct sst_time_evt
+{
+	sst_evt_t super;
+	sst_task_t* task;
+	uint32_t ctr;
+	uint32_t interval;
+	struct sst_time_evt* next;
+} sst_time_evt_t;
+
+
+// -----------------------------------------------------------------------------
+// API
+// -----------------------------------------------------------------------------
+/**
+* @brief Register task at priority with the given queue storage and post it
+* SST_SIG_INIT. Call before sst_run().
+*/
+void sst_task_start(sst_task_t* task, uint8_t priority, const sst_evt_t** queue,
+		uint8_t queue_len, sst_handler_t handler);
+
+/**
+* @brief Queue e for task (from a task or an ISR). Preempts at once if task
+* is more urgent than the running one. A full queue drops e and counts it
+* in g_sst_queue_overflows.
+*/
+void sst_post(sst_task_t* task, const sst_evt_t* e);
+
+/**
+* @brief Bind te (signal sig) to task. Call once, before arming.
+*/
+void sst_time_evt_init(sst_time_evt_t* te, uint16_t sig, sst_task_t* task);
+
+/**
+* @brief Fire te after ticks, then every interval ticks (0: one-shot).
+* ticks == 0 disarms it.
+*/
+void sst_time_evt_arm(sst_time_evt_t* te, uint32_t ticks, uint32_t interval);
+
+/**
+* @brief Make PendSV the lowest priority exception, dispatch the tasks that
+* are already ready and sleep in WFI between events. Never returns.
+*/
+void sst_run(void);
+
+extern uint32_t g_sst_queue_overflows;
+
+
+#endif /* SST_H_ */
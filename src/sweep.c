@@ -0,0 +1,59 @@
+/**
+* @file sweep.c
+* @author sharan-naribole
+* @brief Task-count sweep: load tasks and the reporting task.
+*/
+
+#include "sweep.h"
+#include "kstats.h"
+
+#if SWEEP_TASKS
+
+#include <stdio.h>
+
+_Static_assert(USE_KERNEL_STATS, "the sweep reports through kstats_dump()");
+_Static_assert(SWEEP_TASKS >= 2, "the sweep needs idle and its own task");
+_Static_assert(SWEEP_PRIORITY >= 2, "load tasks run below the sweep task, above idle");
+
+// Load tasks: every TCB slot main() left free
+#define SWEEP_LOAD_TASKS (MAX_TASKS - BOOT_TASK_COUNT)
+
+
+void sweep_task(void* arg)
+{
+	(void)arg;
+	uint32_t created = 0;
+
+	// Runs above every load task, so they all start after this loop
+	for(uint32_t i = 0; i < SWEEP_LOAD_TASKS; i++)
+	{
+		uint32_t period = SWEEP_PERIOD_MIN + ((i * 37U) % SWEEP_PERIOD_SPREAD);
+		uint8_t priority = (uint8_t)(1U + (i % (SWEEP_PRIORITY - 1U)));
+
+		if(task_create(sweep_load_task, (void*)period, SPARE_TASK_STACK_SIZE, priority) >= 0)
+			created++;
+	}
+
+	uint32_t last_wake = g_tick_count;
+
+	while(1)
+	{
+		task_delay_until(&last_wake, SWEEP_DURATION_TICKS);
+		// The build options being compared A/B label every report
+		printf("=== sweep: %d tasks (%lu load) at tick %lu, ram-scheduler=%d pendsv-baseline=%d ===\n",
+				MAX_TASKS, (unsigned long)created, (unsigned long)g_tick_count,
+				USE_RAM_SCHEDULER, PENDSV_BASELINE_CALLS);
+		kstats_dump();
+	}
+}
+
+void sweep_load_task(void* arg)
+{
+	uint32_t period = (uint32_t)arg;
+	uint32_t last_wake = g_tick_count;
+
+	while(1)
+		task_delay_until(&last_wake, period);
+}
+
+#endif // SWEEP_TASKS
@@ -0,0 +1,48 @@
+/**
+* @file sweep.h
+* @author sharan-naribole
+* @brief Task-count sweep: how the kernel's costs scale with MAX_TASKS.
+*
+* With SWEEP_TASKS = N in main.h, main() boots idle plus sweep_task()
+* instead of the LED demo. The sweep task fills the remaining N - 2 TCB
+* slots with periodic load tasks (staggered task_delay_until() periods
+* across priorities 1..SWEEP_PRIORITY-1, each on a SPARE_TASK_STACK_SIZE
+* stack), lets them run for SWEEP_DURATION_TICKS and prints kstats_dump():
+* the systick, quiet, pick and pendsv paths, plus the RAM per task line.
+*
+* Build once per point (5, 32, 128, 256) and compare the avg/max columns
+* between runs; nothing in the tick or switch path should grow with N.
+* At a fixed N, toggling USE_RAM_SCHEDULER compares the jitter columns
+* with the hot path in SRAM and in flash. Needs USE_KERNEL_STATS.
+*/
+
+#ifndef SWEEP_H_
+#define SWEEP_H_
+
+#include "main.h"
+
+#include <stdint.h>
+
+
+// How long the load runs before each report, ticks
+#define SWEEP_DURATION_TICKS (10U * TICK_HZ)
+
+// Load task periods: SWEEP_PERIOD_MIN .. SWEEP_PERIOD_MIN + SWEEP_PERIOD_SPREAD - 1
+// ticks, staggered so releases spread over the ticks
+#define SWEEP_PERIOD_MIN 10U
+#define SWEEP_PERIOD_SPREAD 90U
+
+
+/**
+* @brief Boot task of the sweep: creates the load tasks, then prints
+* kstats_dump() every SWEEP_DURATION_TICKS.
+*/
+void sweep_task(void* arg);
+
+/**
+* @brief One periodic load task; arg is its period in ticks.
+*/
+void sweep_load_task(void* arg);
+
+
+#endif /* SWEEP_H_ */
@@ -0,0 +1,57 @@
+/**
+* @file tcb.h
+* @author sharan-naribole
+* @brief Task control block, shared by the scheduler (main.c) and the
+* timing wheel (timer_wheel.c).
+*/
+
+#ifndef TCB_H_
+#define TCB_H_
+
+#include "main.h"
+
+#include <stdint.h>
+
+
+// -----------------------------------------------------------------------------
+// Task Control Block (TCB)
+/* This is a task control block carries private information of each task */
+typedef struct TCB
+{
+	// Hot: touched on every switch and tick. PendSV relies on the offsets
+	// of the first two fields.
+	uint32_t psp_value; // Process stack pointer snapshot
+#if USE_MPU_STACK_GUARD
+	uint32_t mpu_guard_rbar; // RBAR value putting the guard under this stack
+#endif
+	struct TCB* next; // Ready-list or timing-wheel links (a task is on exactly one)
+	struct TCB* prev;
+	uint32_t block_count; // Wakeup tick
+	uint8_t flags; // TASK_FLAG_* (0: TCB slot is free)
+	uint8_t priority; // Higher value = more urgent; idle is 0
+	uint8_t wheel_level; // Timing-wheel position while BLOCKED (for O(1) unlink)
+	uint8_t wheel_slot;
+#if (SCHED_POLICY == SCHED_POLICY_EDF)
+	uint32_t period; // task_delay_until() period; non-zero puts the task under EDF
+	uint32_t deadline; // Absolute deadline of the current job (EDF)
+	uint32_t deadline_misses; // Jobs that completed after their deadline (EDF)
+#endif
+
+	// Cold: creation, deletion and statistics
+	uint32_t stack_base; // Lowest address of the stack taken from the pool
+	uint16_t stack_size; // Bytes, rounded up to STACK_BLOCK_SIZE
+#if USE_STACK_WATERMARK
+	uint16_t stack_unused; // Lowest count of still-painted bytes above the guard
+	uint16_t generation; // Bumped each time the slot is reused (kept across task_create())
+#endif
+#if USE_KERNEL_STATS
+	uint32_t wake_stamp; // CYCCNT of the tick that woke the task (0: none pending)
+	uint32_t wake_latency_max; // Worst tick-to-run latency seen, cycles
+#endif
+} TCB_t;
+
+#define TASK_IN_USE(tcb) (((tcb)->flags & TASK_FLAG_USED) != 0)
+#define TASK_IS_READY(tcb) (((tcb)->flags & (TASK_FLAG_BLOCKED | TASK_FLAG_DELETED)) == 0)
+
+
+#endif /* TCB_H_ */
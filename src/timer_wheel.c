@@ -0,0 +1,120 @@
+/**
+* @file timer_wheel.c
+* @author sharan-naribole
+* @brief Hierarchical timing wheel for task_delay() wakeups.
+*/
+
+#include "timer_wheel.h"
+
+#include <stddef.h>
+
+
+_Static_assert((TW_LEVELS * TW_SLOT_BITS) >= 32, "timing wheel must cover 32-bit delays");
+_Static_assert(((TW_LEVELS - 1) * TW_SLOT_BITS) < 32, "timing wheel has unreachable levels");
+
+/* BLOCKED tasks by level and slot, each slot a doubly linked list */
+TCB_t* timer_wheel[TW_LEVELS][TW_SLOTS];
+
+/* Bit s of tw_occupied[L] is set while timer_wheel[L][s] is non-empty */
+_Static_assert(TW_SLOT_BITS <= 5, "slot occupancy is kept in one word per level");
+uint32_t tw_occupied[TW_LEVELS];
+
+
+KERNEL_RAMFUNC void timer_wheel_insert(TCB_t* tcb)
+{
+	uint32_t expires = tcb->block_count;
+	uint32_t delta = expires - g_tick_count;
+	uint32_t level = 0;
+
+	// Smallest level whose span (2^((L+1)*bits) ticks) still covers the delay
+	while((level < (TW_LEVELS - 1U)) && (delta >= (1UL << ((level + 1U) * TW_SLOT_BITS))))
+		level++;
+
+	uint32_t slot = (expires >> (level * TW_SLOT_BITS)) & TW_SLOT_MASK;
+	TCB_t** head = &timer_wheel[level][slot];
+
+	tcb->wheel_level = (uint8_t)level;
+	tcb->wheel_slot = (uint8_t)slot;
+	tcb->prev = NULL;
+	tcb->next = *head;
+	if(*head != NULL)
+		(*head)->prev = tcb;
+	*head = tcb;
+	tw_occupied[level] |= (1UL << slot);
+}
+
+KERNEL_RAMFUNC void timer_wheel_remove(TCB_t* tcb)
+{
+	if(tcb->prev != NULL)
+		tcb->prev->next = tcb->next;
+	else if((timer_wheel[tcb->wheel_level][tcb->wheel_slot] = tcb->next) == NULL)
+		tw_occupied[tcb->wheel_level] &= ~(1UL << tcb->wheel_slot);
+	if(tcb->next != NULL)
+		tcb->next->prev = tcb->prev;
+	tcb->next = tcb->prev = NULL;
+}
+
+static KERNEL_RAMFUNC void timer_wheel_cascade(uint32_t level, uint32_t slot)
+{
+	TCB_t* tcb = timer_wheel[level][slot];
+
+	timer_wheel[level][slot] = NULL;
+	tw_occupied[level] &= ~(1UL << slot);
+	while(tcb != NULL)
+	{
+		// Re-hash relative to now: lands on a finer level (level 0 if due this tick)
+		TCB_t* next = tcb->next;
+		timer_wheel_insert(tcb);
+		tcb = next;
+	}
+}
+
+KERNEL_RAMFUNC TCB_t* timer_wheel_expire(uint32_t now)
+{
+	// When levels 0..L-1 have all wrapped, level L's current slot moves down.
+	// Amortized O(1): each sleeper is cascaded at most once per level.
+	for(uint32_t level = 1; level < TW_LEVELS; level++)
+	{
+		if((now & ((1UL << (level * TW_SLOT_BITS)) - 1UL)) != 0)
+			break;
+		timer_wheel_cascade(level, (now >> (level * TW_SLOT_BITS)) & TW_SLOT_MASK);
+	}
+
+	// Everything in the current level-0 slot is due: hand over the whole list
+	uint32_t slot = now & TW_SLOT_MASK;
+	TCB_t* due = timer_wheel[0][slot];
+
+	timer_wheel[0][slot] = NULL;
+	tw_occupied[0] &= ~(1UL << slot);
+	return due;
+}
+
+KERNEL_RAMFUNC uint32_t timer_wheel_next_expiry(void)
+{
+	uint32_t now = g_tick_count;
+	uint32_t earliest = UINT32_MAX;
+
+	for(uint32_t level = 0; level < TW_LEVELS; level++)
+	{
+		uint32_t occupied = tw_occupied[level];
+		if(occupied == 0)
+			continue;
+
+		// Rotate so bit 0 is the slot after the current one; the first set bit
+		// is then this level's next occupied slot in time order
+		uint32_t start = ((now >> (level * TW_SLOT_BITS)) + 1U) & TW_SLOT_MASK;
+		if(start != 0)
+			occupied = ((occupied >> start) | (occupied << (TW_SLOTS - start))) & (0xFFFFFFFFUL >> (32U - TW_SLOTS));
+		uint32_t slot = (start + (uint32_t)__builtin_ctz(occupied)) & TW_SLOT_MASK;
+
+		// That slot holds the level's earliest sleepers; a few to compare at most
+		for(TCB_t* tcb = timer_wheel[level][slot]; tcb != NULL; tcb = tcb->next)
+		{
+			uint32_t delta = tcb->block_count - now;
+			if(delta < earliest)
+				earliest = delta;
+		}
+	}
+
+	return earliest;
+}
@@ -0,0 +1,50 @@
+/**
+* @file timer_wheel.h
+* @author sharan-naribole
+* @brief Hierarchical timing wheel holding the BLOCKED tasks.
+*
+* Tasks are hashed by wakeup tick (block_count) into TW_LEVELS levels of
+* TW_SLOTS slots. Level 0 has one slot per tick; each slot of level L spans
+* the whole of level L-1 and is cascaded down when the levels below it
+* wrap. Insert and remove are O(1); per tick, expiry serves one level-0 slot
+* and cascades a higher slot only on wrap (amortized O(1) per sleeper).
+*
+* Callers hold interrupts off. Only the TCB links (next/prev), block_count
+* and wheel_level/wheel_slot are touched, so bench/ builds this file on the
+* host as is.
+*/
+
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#include "main.h"
+#include "tcb.h"
+
+#include <stdint.h>
+
+
+/**
+* @brief Queue tcb to expire at tcb->block_count (relative to g_tick_count).
+*/
+void timer_wheel_insert(TCB_t* tcb);
+
+/**
+* @brief Take tcb off the wheel before it expires.
+*/
+void timer_wheel_remove(TCB_t* tcb);
+
+/**
+* @brief Advance the wheel to tick now (call once per tick, in order) and
+* detach everything due: returns the due tasks chained through next, or
+* NULL. The chain is the caller's to relink.
+*/
+TCB_t* timer_wheel_expire(uint32_t now);
+
+/**
+* @brief Ticks from g_tick_count to the earliest wakeup, or UINT32_MAX if
+* no task is sleeping.
+*/
+uint32_t timer_wheel_next_expiry(void);
+
+
+#endif /* TIMER_WHEEL_H_ */